@@ -0,0 +1,224 @@
+#ifndef AC_ANALYSIS_H
+#define AC_ANALYSIS_H
+
+#include "circulator_simulator.h"
+#include "thread_pool.h"
+#include <atomic>
+#include <complex>
+
+// ac_analysis.h
+// Small-signal frequency response. The circuit is linearized once at its DC operating point
+// (Circuit::runOperatingPoint), every component stamps its admittance split into
+// Y(w) = G + jw C + Gamma / (jw), and the complex MNA system Y(w) x = b is solved at every
+// frequency with one voltage source driven at amplitude 1:
+//
+//   ACAnalysis ac(circuit);
+//   ac.run(ACAnalysis::decade(1e8, 1e11, 50), options); // options.source, options.probes
+//   ac.getResults().saveToFile("ac.txt");
+//
+// G, C and Gamma share one sparsity pattern, so a point only refills the values. The
+// frequencies are spread over the thread pool, every worker runs the symbolic analysis
+// of the pattern once and a numeric factorization per frequency.
+
+// Complex response of the selected probes, one row per frequency
+class ACResults
+{
+public:
+    const std::vector<double> &getFrequencies() const { return frequencies; }
+    const std::vector<Probe> &getProbes() const { return probes; }
+    std::complex<double> value(size_t row, size_t probe) const { return values[row * probes.size() + probe]; }
+    double magnitude(size_t row, size_t probe) const { return std::abs(value(row, probe)); }
+    double phase(size_t row, size_t probe) const { return std::arg(value(row, probe)) * 180.0 / M_PI; } // [deg]
+
+    void saveToFile(const std::string &filename) const
+    {
+        std::ofstream file(filename);
+        if (!file.is_open())
+        {
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return;
+        }
+
+        // Write header
+        file << "Frequency";
+        for (const auto &probe : probes)
+            file << ", " << probe.label() << " mag, " << probe.label() << " phase";
+        file << "\n";
+
+        // Write data
+        for (size_t row = 0; row < frequencies.size(); ++row)
+        {
+            file << frequencies[row];
+            for (size_t p = 0; p < probes.size(); ++p)
+                file << ", " << magnitude(row, p) << ", " << phase(row, p);
+            file << "\n";
+        }
+    }
+
+private:
+    friend class ACAnalysis;
+
+    std::vector<double> frequencies;
+    std::vector<Probe> probes;
+    std::vector<std::complex<double>> values; // row major, one row per frequency
+};
+
+struct ACOptions
+{
+    int source = 0;            // index of the driven voltage source, the others are shorted
+    unsigned threads = 0;      // 0: one per hardware thread
+    std::vector<Probe> probes; // empty: every node voltage and source current
+};
+
+class ACAnalysis
+{
+public:
+    ACAnalysis(const Circuit &prototype) : prototype(prototype) {}
+
+    // pointsPerDecade logarithmically spaced frequencies from start to stop [Hz]
+    static std::vector<double> decade(double start, double stop, int pointsPerDecade)
+    {
+        int count = std::max(1, int(std::ceil(std::log10(stop / start) * pointsPerDecade)));
+        std::vector<double> frequencies(count + 1);
+        for (int i = 0; i <= count; ++i)
+            frequencies[i] = start * std::pow(stop / start, double(i) / count);
+        return frequencies;
+    }
+
+    // Response at every frequency [Hz], false without an operating point or on a singular Y
+    bool run(const std::vector<double> &frequencies, const ACOptions &options = ACOptions())
+    {
+        using Complex = std::complex<double>;
+        for (double f : frequencies)
+        {
+            if (!(f > 0.0))
+            {
+                std::cerr << "Error: AC frequencies have to be positive, got " << f << std::endl;
+                return false;
+            }
+        }
+
+        // Bias point, the prototype keeps its state
+        std::unique_ptr<Circuit> circuit = prototype.clone();
+        int numNodes = circuit->getNumNodes(), numSources = circuit->getNumVoltageSources();
+        if (options.source < 0 || options.source >= numSources)
+        {
+            std::cerr << "Error: AC source " << options.source << " does not exist" << std::endl;
+            return false;
+        }
+        if (!circuit->runOperatingPoint())
+        {
+            std::cerr << "Error: no DC operating point for the AC analysis" << std::endl;
+            return false;
+        }
+        const Eigen::VectorXd &bias = circuit->getSolution();
+
+        // Stamp the small-signal model and merge G, C and Gamma into one pattern
+        int n = numNodes + numSources;
+        ACStamp ac;
+        ac.numNodes = numNodes;
+        for (size_t i = 0; i < circuit->getNumComponents(); ++i)
+            circuit->getComponent(i)->stampAC(ac, bias);
+        std::vector<Eigen::Triplet<double>> all;
+        for (const auto *part : {&ac.g, &ac.c, &ac.gamma})
+            for (const auto &t : *part)
+                all.emplace_back(t.row(), t.col(), 0.0);
+        for (int i = 0; i < n; ++i)
+            all.emplace_back(i, i, 0.0); // keeps the symbolic analysis away from empty columns
+        Eigen::SparseMatrix<double> pattern(n, n);
+        pattern.setFromTriplets(all.begin(), all.end());
+        pattern.makeCompressed();
+        auto values = [&pattern](const std::vector<Eigen::Triplet<double>> &part) {
+            Eigen::SparseMatrix<double> m = pattern;
+            for (const auto &t : part)
+                m.coeffRef(t.row(), t.col()) += t.value();
+            return std::vector<double>(m.valuePtr(), m.valuePtr() + m.nonZeros());
+        };
+        std::vector<double> g = values(ac.g), c = values(ac.c), gamma = values(ac.gamma);
+
+        // Resolve the probes
+        results = ACResults();
+        results.frequencies = frequencies;
+        results.probes = options.probes;
+        if (results.probes.empty())
+        {
+            for (int node = 1; node <= numNodes; ++node)
+                results.probes.push_back(Probe::nodeVoltage(node));
+            for (int v = 0; v < numSources; ++v)
+                results.probes.push_back(Probe::sourceCurrent(v));
+        }
+        std::vector<int> indices;
+        for (const auto &probe : results.probes)
+            indices.push_back(probe.index(numNodes));
+        results.values.resize(frequencies.size() * indices.size());
+
+        // Per worker copy of Y and its factorization, dense storage as the circuit is set up
+        struct Worker
+        {
+            Eigen::SparseMatrix<Complex> Y;
+            Eigen::SparseLU<Eigen::SparseMatrix<Complex>, Eigen::COLAMDOrdering<int>> sparseLU;
+            Eigen::MatrixXcd denseY;
+            Eigen::PartialPivLU<Eigen::MatrixXcd> denseLU;
+            bool analyzed = false;
+        };
+        bool dense = circuit->getMatrixMode() == MNASystem::Mode::Dense;
+        ThreadPool pool(options.threads);
+        std::vector<Worker> workers(pool.size());
+        std::atomic<size_t> failures(0);
+        Eigen::VectorXcd b = Eigen::VectorXcd::Zero(n);
+        b[numNodes + options.source] = 1.0;
+
+        pool.parallelFor(frequencies.size(), [&](size_t row, unsigned w) {
+            Worker &worker = workers[w];
+            double omega = 2 * M_PI * frequencies[row];
+            if (!worker.analyzed)
+            {
+                worker.Y = pattern.cast<Complex>();
+                if (!dense)
+                    worker.sparseLU.analyzePattern(worker.Y);
+                worker.analyzed = true;
+            }
+            Complex *y = worker.Y.valuePtr();
+            for (size_t k = 0; k < g.size(); ++k)
+                y[k] = Complex(g[k], omega * c[k] - gamma[k] / omega);
+
+            Eigen::VectorXcd x;
+            bool ok;
+            if (dense)
+            {
+                worker.denseY = worker.Y;
+                worker.denseLU.compute(worker.denseY);
+                x = worker.denseLU.solve(b);
+                ok = x.allFinite();
+            }
+            else
+            {
+                worker.sparseLU.factorize(worker.Y);
+                ok = worker.sparseLU.info() == Eigen::Success;
+                if (ok)
+                    x = worker.sparseLU.solve(b);
+            }
+
+            Complex *out = &results.values[row * indices.size()];
+            for (size_t p = 0; p < indices.size(); ++p)
+                out[p] = !ok ? Complex(NAN, NAN) : indices[p] >= 0 ? x[indices[p]] : Complex(0.0);
+            if (!ok)
+                failures++;
+        });
+
+        if (failures > 0)
+        {
+            std::cerr << "Error: singular AC matrix at " << failures << " frequencies" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    const ACResults &getResults() const { return results; }
+
+private:
+    const Circuit &prototype;
+    ACResults results;
+};
+
+#endif // AC_ANALYSIS_H
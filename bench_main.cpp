@@ -0,0 +1,302 @@
+#include "circuit_generators.h"
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <sys/resource.h> // getrusage
+#include <sys/wait.h>     // waitpid
+#include <unistd.h>       // fork, pipe
+
+// circuit_bench: times runDC, runTransient and runTransient_jj on the generated circuits
+// across sizes. Every case runs in a forked child, so the reported peak memory is the
+// case's own. Results go to stdout as a table and optionally to JSON/CSV for tracking.
+//
+//   circuit_bench [--circuits rc,mesh,jj,lc] [--sizes 10,100,1000] [--steps 1000]
+//                 [--mode auto|dense|sparse] [--repeat 3] [--json out.json] [--csv out.csv]
+//                 [--solver direct|mixed|bicgstab|gmres] [--precond ilu|jacobi] [--newton full|modified|lowrank]
+//                 [--stats prefix]
+//
+// With --stats, a CIRCUIT_PROFILING build writes the solver statistics of the last repeat
+// of every case to <prefix>_<circuit>_<analysis>_<size>.json.
+
+namespace
+{
+struct BenchResult
+{
+    char circuit[16];
+    char analysis[16];
+    char mode[8];
+    int size;          // requested size parameter
+    int unknowns;      // MNA system size
+    int steps;
+    double seconds;    // best of the repeats
+    long peakRssKb;
+    bool ok;
+};
+
+// Options shared by all cases
+struct BenchOptions
+{
+    int steps = 1000;
+    int repeat = 3;
+    std::string mode = "auto";
+    std::string solver = "direct";
+    std::string precond = "ilu";
+    std::string newton = "full";
+    std::string statsPrefix;
+};
+
+// Discards the solution, so the timing does not include result storage
+class NullSink : public ResultSink
+{
+public:
+    void record(double, const Eigen::VectorXd &) override {}
+};
+
+std::vector<std::string> split(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+void build(Circuit &circuit, const std::string &name, int size, double dt)
+{
+    if (name == "rc")
+        makeRCLadder(circuit, size, dt);
+    else if (name == "mesh")
+    {
+        int side = std::max(1, int(std::lround(std::sqrt(double(size)))));
+        makeRLCMesh(circuit, side, side, dt);
+    }
+    else if (name == "jj")
+        makeJJArray(circuit, size, dt);
+    else
+        makeLCFilterChain(circuit, size, dt);
+}
+
+std::unique_ptr<LinearSolver> makeSolver(const BenchOptions &options)
+{
+    if (options.solver == "direct")
+        return std::make_unique<DirectSolver>();
+    if (options.solver == "mixed")
+        return std::make_unique<MixedPrecisionSolver>();
+    IterativeOptions iterative;
+    iterative.method = options.solver == "gmres" ? IterativeOptions::Method::GMRES : IterativeOptions::Method::BiCGSTAB;
+    iterative.preconditioner = options.precond == "jacobi" ? IterativeOptions::Preconditioner::Jacobi
+                                                           : IterativeOptions::Preconditioner::ILU;
+    return std::make_unique<IterativeSolver>(iterative);
+}
+
+BenchResult runCase(const std::string &name, const std::string &analysis, int size, const BenchOptions &options)
+{
+    int steps = options.steps;
+    const std::string &mode = options.mode;
+    BenchResult result{};
+    std::snprintf(result.circuit, sizeof(result.circuit), "%s", name.c_str());
+    std::snprintf(result.analysis, sizeof(result.analysis), "%s", analysis.c_str());
+    result.size = size;
+    result.steps = analysis == "dc" ? 1 : steps;
+    result.seconds = 1e300;
+    result.ok = true;
+
+    double dt = name == "jj" ? 1e-14 : 1e-12;
+    for (int r = 0; r < options.repeat; ++r)
+    {
+        Circuit circuit;
+        NullSink sink;
+        circuit.setResultSink(&sink);
+        build(circuit, name, size, dt);
+        int unknowns = circuit.getNumNodes() + circuit.getNumVoltageSources();
+        bool sparse = mode == "sparse" || (mode == "auto" && unknowns > 200);
+        circuit.setMatrixMode(sparse ? MNASystem::Mode::Sparse : MNASystem::Mode::Dense);
+        std::snprintf(result.mode, sizeof(result.mode), "%s", sparse ? "sparse" : "dense");
+        result.unknowns = unknowns;
+        circuit.setLinearSolver(makeSolver(options));
+        NROptions nr;
+        nr.modifiedNewton = options.newton == "modified";
+        nr.lowRankUpdate = options.newton == "lowrank";
+        circuit.setNROptions(nr);
+        if (!options.statsPrefix.empty())
+            circuit.setStatsFile(options.statsPrefix + "_" + name + "_" + analysis + "_" + std::to_string(size) + ".json");
+
+        auto start = std::chrono::steady_clock::now();
+        if (analysis == "dc")
+            circuit.runDC();
+        else if (analysis == "tran")
+            circuit.runTransient(steps * dt, dt);
+        else
+            circuit.runTransient_jj(steps * dt, dt);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.seconds = std::min(result.seconds, seconds);
+        result.ok = result.ok && circuit.getSolution().allFinite();
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result.peakRssKb = usage.ru_maxrss;
+    return result;
+}
+
+// Run the case in a child process and read its result back through a pipe
+bool runForked(const std::string &name, const std::string &analysis, int size, const BenchOptions &options,
+               BenchResult &result)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+    pid_t pid = fork();
+    if (pid < 0)
+        return false;
+    if (pid == 0)
+    {
+        close(fds[0]);
+        BenchResult child = runCase(name, analysis, size, options);
+        ssize_t written = write(fds[1], &child, sizeof(child));
+        _exit(written == sizeof(child) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return got == sizeof(result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+void writeJson(const std::string &filename, const std::vector<BenchResult> &results)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        return;
+    }
+    file << "[\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult &r = results[i];
+        file << "  {\"circuit\": \"" << r.circuit << "\", \"analysis\": \"" << r.analysis
+             << "\", \"mode\": \"" << r.mode << "\", \"size\": " << r.size << ", \"unknowns\": " << r.unknowns
+             << ", \"steps\": " << r.steps << ", \"seconds\": " << r.seconds
+             << ", \"us_per_step\": " << 1e6 * r.seconds / r.steps << ", \"steps_per_second\": " << r.steps / r.seconds
+             << ", \"peak_rss_kb\": " << r.peakRssKb << ", \"ok\": " << (r.ok ? "true" : "false") << "}"
+             << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "]\n";
+}
+
+void writeCsv(const std::string &filename, const std::vector<BenchResult> &results)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        return;
+    }
+    file << "circuit,analysis,mode,size,unknowns,steps,seconds,us_per_step,steps_per_second,peak_rss_kb,ok\n";
+    for (const BenchResult &r : results)
+    {
+        file << r.circuit << "," << r.analysis << "," << r.mode << "," << r.size << "," << r.unknowns << ","
+             << r.steps << "," << r.seconds << "," << 1e6 * r.seconds / r.steps << "," << r.steps / r.seconds << ","
+             << r.peakRssKb << "," << (r.ok ? 1 : 0) << "\n";
+    }
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> circuits{"rc", "mesh", "jj", "lc"};
+    std::vector<int> sizes{10, 100, 1000};
+    BenchOptions options;
+    std::string json, csv;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--circuits" && hasValue)
+            circuits = split(argv[++i]);
+        else if (arg == "--sizes" && hasValue)
+        {
+            sizes.clear();
+            for (const std::string &s : split(argv[++i]))
+                sizes.push_back(std::stoi(s));
+        }
+        else if (arg == "--steps" && hasValue)
+            options.steps = std::stoi(argv[++i]);
+        else if (arg == "--repeat" && hasValue)
+            options.repeat = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--mode" && hasValue)
+            options.mode = argv[++i];
+        else if (arg == "--json" && hasValue)
+            json = argv[++i];
+        else if (arg == "--csv" && hasValue)
+            csv = argv[++i];
+        else if (arg == "--stats" && hasValue)
+            options.statsPrefix = argv[++i];
+        else if (arg == "--solver" && hasValue)
+            options.solver = argv[++i];
+        else if (arg == "--precond" && hasValue)
+            options.precond = argv[++i];
+        else if (arg == "--newton" && hasValue)
+            options.newton = argv[++i];
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--circuits rc,mesh,jj,lc] [--sizes 10,100,1000] [--steps N]"
+                      << " [--mode auto|dense|sparse] [--repeat N] [--json file] [--csv file]"
+                      << " [--solver direct|mixed|bicgstab|gmres] [--precond ilu|jacobi] [--newton full|modified|lowrank]"
+                      << " [--stats prefix]" << std::endl;
+            return 1;
+        }
+    }
+
+    if ((options.solver != "direct" && options.solver != "mixed" && options.solver != "bicgstab" && options.solver != "gmres") ||
+        (options.precond != "ilu" && options.precond != "jacobi") ||
+        (options.newton != "full" && options.newton != "modified" && options.newton != "lowrank"))
+    {
+        std::cerr << "Error: unknown solver " << options.solver << "/" << options.precond << "/" << options.newton << std::endl;
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+    std::printf("%-7s %-8s %-7s %8s %9s %7s %12s %12s %14s %10s\n", "circuit", "analysis", "mode", "size",
+                "unknowns", "steps", "total [ms]", "step [us]", "steps/s", "peak [MB]");
+    for (const std::string &name : circuits)
+    {
+        if (name != "rc" && name != "mesh" && name != "jj" && name != "lc")
+        {
+            std::cerr << "Error: unknown circuit " << name << std::endl;
+            return 1;
+        }
+        // The junction array is nonlinear, the others run the DC and factor-once transient paths
+        std::vector<std::string> analyses = name == "jj" ? std::vector<std::string>{"tran_jj"}
+                                                         : std::vector<std::string>{"dc", "tran"};
+        for (int size : sizes)
+        {
+            for (const std::string &analysis : analyses)
+            {
+                BenchResult r;
+                if (!runForked(name, analysis, size, options, r))
+                {
+                    std::cerr << "Error: " << name << " " << analysis << " size " << size << " failed" << std::endl;
+                    continue;
+                }
+                std::printf("%-7s %-8s %-7s %8d %9d %7d %12.3f %12.3f %14.1f %10.1f%s\n", r.circuit, r.analysis, r.mode,
+                            r.size, r.unknowns, r.steps, 1e3 * r.seconds, 1e6 * r.seconds / r.steps, r.steps / r.seconds,
+                            r.peakRssKb / 1024.0, r.ok ? "" : "  (non-finite solution)");
+                results.push_back(r);
+            }
+        }
+    }
+
+    if (!json.empty())
+        writeJson(json, results);
+    if (!csv.empty())
+        writeCsv(csv, results);
+    return 0;
+}
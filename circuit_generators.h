@@ -0,0 +1,77 @@
+#ifndef CIRCUIT_GENERATORS_H
+#define CIRCUIT_GENERATORS_H
+
+#include "circulator_simulator.h"
+
+// circuit_generators.h
+// Parameterized circuits whose size scales with n, for benchmarks and solver checks.
+// Every generator drives the circuit from one voltage source at node 1 and numbers the
+// nodes without gaps, so the MNA matrix is never structurally singular.
+
+// RC ladder: V -- R -- node 2 -- R -- node 3 ... with C from every ladder node to ground.
+// n sections, n + 1 nodes.
+inline void makeRCLadder(Circuit &circuit, int n, double dt, double r = 1e3, double c = 1e-12)
+{
+    circuit.reserve(2 * n + 1);
+    circuit.emplaceComponent<VoltageSource>(1, 0, 1.0, 0);
+    for (int k = 1; k <= n; ++k)
+    {
+        circuit.emplaceComponent<Resistor>(k, k + 1, r);
+        circuit.emplaceComponent<Capacitor>(k + 1, 0, c, dt);
+    }
+}
+
+// rows x cols RLC mesh: resistors between horizontal neighbours, inductors between
+// vertical neighbours and a capacitor from every mesh node to ground. Node 1 is the
+// source, fed into the corner of the mesh through a resistor.
+inline void makeRLCMesh(Circuit &circuit, int rows, int cols, double dt,
+                        double r = 10.0, double l = 1e-9, double c = 1e-12)
+{
+    auto node = [cols](int i, int j) { return 2 + i * cols + j; };
+    circuit.reserve(2 + rows * cols * 3);
+    circuit.emplaceComponent<VoltageSource>(1, 0, 1.0, 0);
+    circuit.emplaceComponent<Resistor>(1, node(0, 0), r);
+    for (int i = 0; i < rows; ++i)
+    {
+        for (int j = 0; j < cols; ++j)
+        {
+            if (j + 1 < cols)
+                circuit.emplaceComponent<Resistor>(node(i, j), node(i, j + 1), r);
+            if (i + 1 < rows)
+                circuit.emplaceComponent<Inductor>(node(i, j), node(i + 1, j), l, dt);
+            circuit.emplaceComponent<Capacitor>(node(i, j), 0, c, dt);
+        }
+    }
+}
+
+// n Josephson junctions in series, biased from the source through a resistor.
+// Junction nodes are 2 .. n + 1, the phase nodes follow.
+inline void makeJJArray(Circuit &circuit, int n, double dt, double bias = 1e-3,
+                        double ic = 1e-4, double r = 10.0, double c = 1e-13)
+{
+    circuit.reserve(n + 2);
+    circuit.emplaceComponent<VoltageSource>(1, 0, bias, 0);
+    circuit.emplaceComponent<Resistor>(1, 2, 5.0);
+    int phase = n + 2;
+    for (int k = 0; k < n; ++k)
+    {
+        int a = 2 + k, b = k == n - 1 ? 0 : 3 + k;
+        circuit.emplaceComponent<JosephsonJunction>(a, b, phase++, ic, r, c, dt);
+    }
+}
+
+// LC low-pass chain: series inductors with shunt capacitors, terminated in a load resistor.
+// n sections, n + 1 nodes.
+inline void makeLCFilterChain(Circuit &circuit, int n, double dt, double l = 1e-9, double c = 1e-12, double load = 50.0)
+{
+    circuit.reserve(2 * n + 2);
+    circuit.emplaceComponent<VoltageSource>(1, 0, 1.0, 0);
+    for (int k = 1; k <= n; ++k)
+    {
+        circuit.emplaceComponent<Inductor>(k, k + 1, l, dt);
+        circuit.emplaceComponent<Capacitor>(k + 1, 0, c, dt);
+    }
+    circuit.emplaceComponent<Resistor>(n + 1, 0, load);
+}
+
+#endif // CIRCUIT_GENERATORS_H
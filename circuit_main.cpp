@@ -1,9 +1,14 @@
 #include "circulator_simulator.h"
-#include "random.h" // Monte Carlo sampling 
+#include "ensemble.h" // Monte Carlo sampling 
+#include "sweep.h"    // DC sweeps
+#include "ac_analysis.h" // small-signal frequency response
+#include "pss.h"         // periodic steady state
+#include "measure.h"     // online measurements, decimated output
+#include "model_reduction.h" // Krylov reduction of passive sub-networks
 #include <memory>
 #include <iostream>
 
-int main(int argc, char *argv[])
+int main()
 {
     Circuit c1;
      /* Expected results for this voltage divider:
@@ -21,12 +26,19 @@ int main(int argc, char *argv[])
     // Print results
     c1.printSolution();
 
+    // Sweep the source of the divider from 0 to 10 V for two values of R2
+    Sweep sweep(c1, {SweepParameter::value(0, SweepParameter::linear(0.0, 10.0, 101)),
+                     SweepParameter::value(2, {1000.0, 2000.0})});
+    sweep.run();
+    sweep.getResults().saveToFile("dc_sweep.txt");
+
     // There are some issue with setting of the VoltageSource, 
     // FIXME, one should update it to allow trasient behavior
     Circuit c2;
     c2.addComponent(std::make_unique<VoltageSource>(1, 0, 5.0, 0)); // 5V source
     c2.addComponent(std::make_unique<Inductor>(1, 2, 1e-3, 0.00001)); // 1mH inductor
     c2.addComponent(std::make_unique<Capacitor>(2, 0, 1e-6, 0.00001)); // 1µF capacitor
+    std::unique_ptr<Circuit> atRest = c2.clone(); // Monte Carlo prototype, before c2 moves on in time
     c2.runTransient(0.01, 0.00001); // Simulate for 10ms with 1ms time step
     // Access and print results
     const auto& results = c2.getResults();
@@ -40,12 +52,79 @@ int main(int argc, char *argv[])
     // Save results to a file
     c2.saveResultsToFile("output.txt");
 
-    // TODO: random seed VoltageSource, the random fluctuation is slightly slower than time step in time domain simulation
+    // Frequency response of the LC circuit, resonance at 1 / (2 pi sqrt(LC)) = 5.03 kHz
+    ACAnalysis ac(c2);
+    ac.run(ACAnalysis::decade(1e2, 1e6, 20));
+    ac.getResults().saveToFile("ac_output.txt");
+
+    // Random seed VoltageSource, the random fluctuation is slightly slower than time step in time domain simulation.
+    // Every sample clones c2 at rest, draws its own noise sequence for the source and runs the transient,
+    // only the mean and standard deviation of the node voltages are kept.
+    double endTime = 0.001, timeStep = 0.00001;
+    Ensemble mc(*atRest, [&](Circuit &circuit, Philox &rng, size_t) {
+        std::vector<double> voltage = MCSampler::sample(rng, endTime, 5 * timeStep, 5.0, 0.05, MCSampler::Distribution::Normal);
+        static_cast<VoltageSource *>(circuit.getComponent(0))->setWaveform(MCSampler::waveform(voltage, 5 * timeStep));
+    });
+    EnsembleOptions options;
+    options.samples = 1000;
+    options.probes = {Probe::nodeVoltage(1), Probe::nodeVoltage(2)};
+    mc.runTransient(endTime, timeStep, options);
+    const EnsembleStatistics &stats = mc.getStatistics();
+    std::cout << "Monte Carlo, " << stats.numSamples() << " samples, Node 2 at t = " << stats.getTimes().back() << " s: "
+              << stats.mean(stats.getTimes().size() - 1, 1) << " +- " << stats.stddev(stats.getTimes().size() - 1, 1) << " V" << std::endl;
+    stats.saveToFile("mc_output.txt");
+
+    // Steady state of a series RLC driven at 4 kHz, without simulating the startup
     Circuit c3;
-    std::vector<double> voltage = MCSampler.sample(endTime, timeStep, mean, std, type) // 
-    for ( // for each voltage, simulate the time domain of lc circuit, save all the output data )
+    double drive = 4e3, step = 1.0 / drive / 200;
+    auto source = std::make_unique<VoltageSource>(1, 0, 0.0, 0);
+    source->setWaveform([drive](double t) { return std::sin(2 * M_PI * drive * t); });
+    c3.addComponent(std::move(source));
+    c3.addComponent(std::make_unique<Resistor>(1, 2, 10.0));
+    c3.addComponent(std::make_unique<Inductor>(2, 3, 1e-3, step));
+    c3.addComponent(std::make_unique<Capacitor>(3, 0, 1e-6, step));
+    c3.setIntegrationMethod(IntegrationMethod::Trapezoidal);
+    std::unique_ptr<Circuit> startup = c3.clone();
+    PeriodicSteadyState pss(c3);
+    if (pss.run(1.0 / drive, step))
+        c3.saveResultsToFile("pss_output.txt");
+    std::cout << "Periodic steady state after " << pss.getPeriods() << " simulated periods" << std::endl;
+
+    // The same startup as a plain transient over 100 periods, only measured and kept as envelope
+    DecimatingSink envelope(Decimation::envelope(200));
+    MeasurementSink measure(&envelope);
+    measure.add(Measurement::max("vc_max", Probe::nodeVoltage(3)));
+    measure.add(Measurement::rms("i_rms", Probe::sourceCurrent(0), 90.0 / drive));
+    measure.add(Measurement::peakToPeak("vc_pp", Probe::nodeVoltage(3), 90.0 / drive));
+    startup->setResultSink(&measure);
+    startup->runTransient(100.0 / drive, step);
+    measure.print(std::cout);
+    envelope.saveToFile("envelope_output.txt");
+
+    // A junction at the end of a 500 section LC ladder. The ladder becomes one reduced
+    // multi-port between the source resistor and the junction node.
+    Circuit c4;
+    double jjStep = 0.2e-12;
+    int sections = 500, end = 2 + sections;
+    c4.addComponent(std::make_unique<VoltageSource>(1, 0, 5e-5, 0));
+    c4.addComponent(std::make_unique<Resistor>(1, 2, 1.0));
+    for (int k = 0; k < sections; ++k)
+    {
+        c4.addComponent(std::make_unique<Inductor>(2 + k, 3 + k, 1e-12, jjStep));
+        c4.addComponent(std::make_unique<Capacitor>(3 + k, 0, 1e-14, jjStep));
+    }
+    c4.addComponent(std::make_unique<JosephsonJunction>(end, 0, end + 1, 1e-4, 5.0, 1e-14, jjStep));
+    ModelReduction reduction(c4);
+    ReductionOptions reductionOptions;
+    reductionOptions.moments = 8;
+    if (reduction.run(reductionOptions))
+    {
+        Circuit &reduced = reduction.getCircuit();
+        reduced.runTransient_jj(100e-12, jjStep);
+        std::cout << "Reduced " << c4.getNumNodes() << " nodes to " << reduced.getNumNodes() << ", junction phase "
+                  << reduced.getSolution()[reduction.node(end + 1) - 1] << " rad" << std::endl;
+    }
 
-    
     // TODO: inductor, capacitor, JJ parallel circuit, with parallel voltageSource, 
     // apply fluctuation to the voltageSource
     // sample inductor, capacitor, JJ's node voltage 
@@ -1,17 +1,296 @@
 #ifndef CIRCUIT_SIMULATOR_H
 #define CIRCUIT_SIMULATOR_H
 
+#include <algorithm>
 #include <cmath>
 #include <string>
 #include <vector>
 #include <memory> // to allow dynamic memory allocaiton of using smart pointers
+#include <functional> // time dependent source waveforms
+#include <chrono>     // phase timers of CIRCUIT_PROFILING builds
+#include <cstdint>
+#include <cstdio>     // std::rename of checkpoint files
+#include <cstddef>    // std::max_align_t of the component arena
+#include <new>        // placement new into the component arena
 #include <Eigen/Dense> // Eigen3 package for linear algebra
+#include <Eigen/Sparse> // sparse matrix and SparseLU for large circuits
+#include "linear_solver.h"
 #include <fstream>
 #include <iostream> // For std::cout, std::cerr
 #include <iomanip>  // For std::setw, std::setprecision
 
 // std::map<std::string, double> constants; // constants = {"resistor": 1, "capacitor": 1}
 
+// Time integration of the reactive components
+enum class IntegrationMethod { BackwardEuler, Trapezoidal, Gear2 };
+
+// Derivative approximation dy/dt(n) = a0 y(n) + a1 y(n-1) + a2 y(n-2) + b1 dy/dt(n-1)
+// of the integration method for the step h, hPrev is the step before (Gear2 only)
+struct IntegrationCoeffs
+{
+    double a0, a1, a2, b1;
+
+    static IntegrationCoeffs make(IntegrationMethod method, double h, double hPrev)
+    {
+        switch (method)
+        {
+        case IntegrationMethod::Trapezoidal:
+            return {2.0 / h, -2.0 / h, 0.0, -1.0};
+        case IntegrationMethod::Gear2:
+        {
+            // Variable step BDF2, omega = h / hPrev
+            double w = h / hPrev;
+            return {(1.0 + 2.0 * w) / (h * (1.0 + w)), -(1.0 + w) / h, w * w / (h * (1.0 + w)), 0.0};
+        }
+        default:
+            return {1.0 / h, -1.0 / h, 0.0, 0.0};
+        }
+    }
+};
+
+// Solver-owned storage of the MNA system Ax = z.
+// Components stamp straight into the matrix the LU factorizes: the dense mode writes
+// into an Eigen matrix, the sparse mode writes into the values of a compressed matrix
+// whose pattern is collected once from (row, col, value) triplets on the first stamp.
+// Storage is kept between steps and zeroed in place, x holds the solution and is read
+// by the components directly. Rows and columns are 0-based, components take care of
+// skipping the ground node.
+class MNASystem
+{
+public:
+    enum class Mode { Dense, Sparse };
+
+    MNASystem() : mode(Mode::Dense), numNodes(0), numVoltageSources(0), patternBuilt(false), patternMismatch(false), patternVersion(0),
+                  timeStep(0.0), time(0.0), coeffs{0.0, 0.0, 0.0, 0.0}, operatingPoint(false) {}
+
+    // Size to (nodes + voltage sources) and zero A and z, the storage is only
+    // reallocated when the size or the mode changes
+    void reset(int nodes, int voltageSources, Mode m)
+    {
+        int n = nodes + voltageSources;
+        if (m != mode || n != size())
+        {
+            mode = m;
+            numNodes = nodes;
+            numVoltageSources = voltageSources;
+            invalidatePattern();
+            if (mode == Mode::Dense)
+            {
+                denseA.resize(n, n);
+                sparseA.resize(0, 0);
+            }
+            else
+            {
+                denseA.resize(0, 0);
+                sparseA.resize(n, n);
+            }
+            z.resize(n);
+            int old = std::min<int>(x.size(), n);
+            x.conservativeResize(n);
+            x.tail(n - old).setZero();
+            patternVersion++; // addresses into the old storage are stale
+        }
+        numNodes = nodes;
+        numVoltageSources = voltageSources;
+
+        if (mode == Mode::Dense)
+            denseA.setZero();
+        else if (patternBuilt)
+            std::fill(sparseA.valuePtr(), sparseA.valuePtr() + sparseA.nonZeros(), 0.0);
+        else
+            triplets.clear();
+        z.setZero();
+    }
+
+    void addA(int row, int col, double value)
+    {
+        if (mode == Mode::Dense)
+        {
+            denseA(row, col) += value;
+        }
+        else if (!patternBuilt)
+        {
+            triplets.emplace_back(row, col, value);
+        }
+        else
+        {
+            double *entry = findEntry(row, col);
+            if (entry)
+                *entry += value;
+            else
+                patternMismatch = true;
+        }
+    }
+
+    // Zero only the RHS, the matrix is kept for the factor-once transient path
+    void clearRHS() { z.setZero(); }
+
+    // Keep the current A and z as the baseline every NR iteration starts from,
+    // so the linear part is not restamped for each iteration
+    void saveBaseline()
+    {
+        if (mode == Mode::Dense)
+            baseValues.assign(denseA.data(), denseA.data() + denseA.size());
+        else
+            baseValues.assign(sparseA.valuePtr(), sparseA.valuePtr() + sparseA.nonZeros());
+        baseZ = z;
+    }
+    void restoreBaseline()
+    {
+        double *values = mode == Mode::Dense ? denseA.data() : sparseA.valuePtr();
+        std::copy(baseValues.begin(), baseValues.end(), values);
+        z = baseZ;
+    }
+
+    // Address of A(row, col) in the current storage, nullptr when the sparse pattern does not
+    // hold the entry. Valid until the pattern version changes.
+    double *entry(int row, int col)
+    {
+        if (mode == Mode::Dense)
+            return &denseA(row, col);
+        return patternBuilt ? findEntry(row, col) : nullptr;
+    }
+    double *rhsEntry(int row) { return z.data() + row; }
+
+    void addZ(int row, double value) { z(row) += value; }
+    void setZ(int row, double value) { z(row) = value; }
+
+    // Called after all components have stamped. Returns false when an entry fell outside
+    // the sparse pattern, the pattern is then dropped and the caller has to stamp again.
+    bool finishStamping()
+    {
+        if (mode != Mode::Sparse)
+            return true;
+        if (patternMismatch)
+        {
+            invalidatePattern();
+            return false;
+        }
+        if (!patternBuilt)
+        {
+            sparseA.setFromTriplets(triplets.begin(), triplets.end());
+            sparseA.makeCompressed();
+            triplets.clear();
+            patternBuilt = true;
+            patternVersion++;
+        }
+        return true;
+    }
+
+    void invalidatePattern()
+    {
+        patternBuilt = false;
+        patternMismatch = false;
+        triplets.clear();
+    }
+
+    // Step of the time point being solved, the companion models read it at stamp time.
+    // A step of 0 (DC) lets each component fall back to backward Euler with its own dt.
+    void setTimeStep(IntegrationMethod method, double h, double hPrev, double t)
+    {
+        timeStep = h;
+        time = t;
+        coeffs = IntegrationCoeffs::make(method, h, hPrev);
+        operatingPoint = false;
+    }
+    void clearTimeStep()
+    {
+        timeStep = 0.0;
+        time = 0.0;
+        operatingPoint = false;
+    }
+
+    // DC operating point, set after clearTimeStep(): capacitors are open, inductors a short
+    // of shortConductance and junctions carry no voltage, every node has gmin to ground
+    void setOperatingPoint(bool op) { operatingPoint = op; }
+    bool isOperatingPoint() const { return operatingPoint; }
+    static constexpr double shortConductance = 1e6; // [S]
+    static constexpr double gmin = 1e-12;           // [S]
+
+    double getTimeStep() const { return timeStep; }
+    double getTime() const { return time; } // time of the point being solved
+    IntegrationCoeffs coefficients(double defaultStep) const
+    {
+        return timeStep > 0.0 ? coeffs : IntegrationCoeffs::make(IntegrationMethod::BackwardEuler, defaultStep, defaultStep);
+    }
+
+    Mode getMode() const { return mode; }
+    int size() const { return numNodes + numVoltageSources; }
+    int getNumNodes() const { return numNodes; }                   // voltage source rows start here
+    int getNumVoltageSources() const { return numVoltageSources; }
+    int getPatternVersion() const { return patternVersion; }        // changes whenever the storage is reallocated or a new sparse pattern is built
+    bool hasPattern() const { return mode != Mode::Sparse || patternBuilt; }
+
+    const Eigen::MatrixXd &denseMatrix() const { return denseA; }
+    const Eigen::SparseMatrix<double> &sparseMatrix() const { return sparseA; }
+    const Eigen::VectorXd &rhs() const { return z; }
+    Eigen::VectorXd &solution() { return x; }
+    const Eigen::VectorXd &solution() const { return x; }
+
+private:
+    // Binary search of (row, col) in the compressed column
+    double *findEntry(int row, int col)
+    {
+        const int *inner = sparseA.innerIndexPtr();
+        const int *begin = inner + sparseA.outerIndexPtr()[col];
+        const int *end = inner + sparseA.outerIndexPtr()[col + 1];
+        const int *it = std::lower_bound(begin, end, row);
+        if (it == end || *it != row)
+            return nullptr;
+        return sparseA.valuePtr() + (it - inner);
+    }
+
+    Mode mode;
+    int numNodes;
+    int numVoltageSources;
+    Eigen::MatrixXd denseA;                        // dense MNA matrix
+    Eigen::SparseMatrix<double> sparseA;           // sparse MNA matrix, compressed column storage
+    std::vector<Eigen::Triplet<double>> triplets;  // entries collected while the sparse pattern is built
+    bool patternBuilt;
+    bool patternMismatch;
+    int patternVersion;
+    std::vector<double> baseValues;                // NR baseline of the matrix values
+    Eigen::VectorXd baseZ;                         // NR baseline of the RHS
+    Eigen::VectorXd z;                             // RHS vector
+    Eigen::VectorXd x;                             // Solution vector (voltages and currents)
+    double timeStep;                               // step being solved, 0 outside a transient
+    double time;
+    IntegrationCoeffs coeffs;
+    bool operatingPoint;
+};
+
+// Small-signal admittance of a circuit linearized at its operating point,
+// Y(w) = G + jw C + Gamma / (jw), collected as triplets of the three real parts
+struct ACStamp
+{
+    int numNodes = 0; // voltage source rows start here
+    std::vector<Eigen::Triplet<double>> g, c, gamma;
+
+    // Two-terminal admittance y between nodes n1 and n2 (0 is ground) into part m
+    static void branch(std::vector<Eigen::Triplet<double>> &m, int n1, int n2, double y)
+    {
+        if (n1 > 0)
+        {
+            m.emplace_back(n1 - 1, n1 - 1, y);
+            if (n2 > 0)
+                m.emplace_back(n1 - 1, n2 - 1, -y);
+        }
+        if (n2 > 0)
+        {
+            if (n1 > 0)
+                m.emplace_back(n2 - 1, n1 - 1, -y);
+            m.emplace_back(n2 - 1, n2 - 1, y);
+        }
+    }
+};
+
+// What a value written by Component::saveState is: a parameter, or integration history
+// with its unit. The periodic steady-state analysis solves for the history values,
+// phases only have to repeat modulo 2 pi.
+enum class StateKind : char { Parameter, Voltage, Current, Rate, Phase };
+
+class ComponentArena;
+
 // circuit_simulator.h
 // Base class for every component in the circuit,
 // right now the circuit contains L, C , R, V, I components,
@@ -26,47 +305,701 @@ protected:            // protected members can be accessed by derived classes, r
 
 public:
     virtual ~Component() = default;
-    // Modified interface for MNA
-    virtual void stamp(std::vector<std::vector<double>> &A, std::vector<double> &z,
-                       const std::vector<double> &x, int numVoltageSources) = 0;
+    // Modified interface for MNA, stamps through sys so the same code fills dense or sparse storage.
+    // stampMatrix is the part of A that stays constant for a fixed time step,
+    // stampRHS is the per-step part of z (history current sources, source values).
+    virtual void stampMatrix(MNASystem &sys) const = 0;
+    virtual void stampRHS(MNASystem &) const {}
+    // Advance the integration state once the time step has been solved,
+    // sys still holds the solution and the step coefficients it was solved with
+    virtual void acceptStep(const MNASystem &) {}
+    // Nonlinear devices stamp their linearization around the current NR operating point
+    // on top of stampMatrix/stampRHS, the operating point is moved by updateOperatingPoint
+    // after every NR iteration. A circuit containing one cannot reuse the factorization between steps.
+    virtual bool isNonlinear() const { return false; }
+    virtual void stampNonlinear(MNASystem &) const {}
+    virtual void updateOperatingPoint(const Eigen::VectorXd &) {}
     virtual bool isVoltageSource() const { return false; }
+    // Small-signal model around the operating point x for AC analysis
+    virtual void stampAC(ACStamp &, const Eigen::VectorXd &) const {}
+    // Indices of the unknowns the component stamps, which it couples in A.
+    // The topology pass of the circuit groups the unknowns into independent blocks with them.
+    virtual void appendUnknowns(int /*numNodes*/, std::vector<int> &unknowns) const
+    {
+        if (node1 > 0)
+            unknowns.push_back(node1 - 1);
+        if (node2 > 0)
+            unknowns.push_back(node2 - 1);
+    }
+    // Largest node number the component connects to, the circuit sizes its nodes with it
+    virtual int highestNode() const { return std::max(node1, node2); }
+    // Move the component to other node numbers, map[old] = new with map[0] = 0
+    virtual void renumberNodes(const std::vector<int> &map)
+    {
+        node1 = map[node1];
+        node2 = map[node2];
+    }
+    // Copy of the component including its integration state, used to replicate a circuit
+    virtual std::unique_ptr<Component> clone() const = 0;
+    // The same copy constructed in the arena, nullptr falls back to clone()
+    virtual Component *cloneInto(ComponentArena &) const { return nullptr; }
+    // Value and integration state for checkpoints, appended to state and read back in the
+    // same order; restoreState returns the position after the component's values
+    virtual void saveState(std::vector<double> &state) const { state.push_back(value); }
+    virtual const double *restoreState(const double *state)
+    {
+        value = *state++;
+        return state;
+    }
+    // One kind per value of saveState, in the same order
+    virtual void appendStateKinds(std::vector<StateKind> &kinds) const { kinds.push_back(StateKind::Parameter); }
     int getNode1() const { return node1; } // Getter for node1
     int getNode2() const { return node2; } // Getter for node2
+    double getValue() const { return value; }
+    void setValue(double v) { value = v; } // e.g. a Monte Carlo perturbation of R, L, C or V
+};
+
+// Bump allocator of the components of a circuit: they are placed one after another in a
+// few large blocks instead of one heap allocation each. The memory is released with the
+// arena, the circuit runs the destructors (ComponentDeleter).
+class ComponentArena
+{
+public:
+    ComponentArena() : offset(0), capacity(0), used(0) {}
+    ComponentArena(const ComponentArena &) = delete;
+    ComponentArena &operator=(const ComponentArena &) = delete;
+    ComponentArena(ComponentArena &&) = default; // the blocks move, the components stay in place
+
+    template <typename T, typename... Args>
+    T *create(Args &&...args)
+    {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned component");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Room for bytes more in the current block, e.g. before copying a whole circuit in
+    void reserve(size_t bytes)
+    {
+        if (blocks.empty() || capacity - offset < bytes)
+            grow(bytes);
+    }
+    size_t bytesUsed() const { return used; } // including alignment padding
+
+private:
+    void *allocate(size_t size, size_t align)
+    {
+        size_t start = (offset + align - 1) & ~(align - 1);
+        if (blocks.empty() || start + size > capacity)
+        {
+            grow(size);
+            start = 0;
+        }
+        used += start + size - offset;
+        offset = start + size;
+        return blocks.back().get() + start;
+    }
+
+    // Blocks double up to 1 MB, so a small circuit does not hold a large block
+    void grow(size_t bytes)
+    {
+        capacity = std::max(bytes, std::min<size_t>(std::max<size_t>(2 * capacity, 4096), size_t(1) << 20));
+        blocks.emplace_back(new char[capacity]); // aligned for any standard type
+        offset = 0;
+    }
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t offset;   // into the last block
+    size_t capacity; // of the last block
+    size_t used;
+};
+
+// Owner of a component in Circuit: heap components (addComponent) are deleted, arena
+// components (emplaceComponent, clone) only destroyed
+struct ComponentDeleter
+{
+    bool heap = true;
+    ComponentDeleter() = default;
+    explicit ComponentDeleter(bool heap) : heap(heap) {}
+    ComponentDeleter(std::default_delete<Component>) {} // from std::unique_ptr<Component>
+    void operator()(Component *component) const
+    {
+        if (heap)
+            delete component;
+        else
+            component->~Component();
+    }
+};
+using ComponentPtr = std::unique_ptr<Component, ComponentDeleter>;
+
+// A signal of the solution vector selected for recording
+struct Probe
+{
+    enum class Kind { NodeVoltage, JunctionPhase, SourceCurrent };
+    Kind kind;
+    int id; // node number, JJ phase node or voltage source index
+
+    static Probe nodeVoltage(int node) { return {Kind::NodeVoltage, node}; }
+    static Probe junctionPhase(int phaseNode) { return {Kind::JunctionPhase, phaseNode}; }
+    static Probe sourceCurrent(int voltageIdx) { return {Kind::SourceCurrent, voltageIdx}; }
+
+    // Whether the signal exists in a circuit of this size, the ground node included
+    bool valid(int numNodes, int numVoltageSources) const
+    {
+        if (kind == Kind::SourceCurrent)
+            return id >= 0 && id < numVoltageSources;
+        return id >= 0 && id <= numNodes;
+    }
+
+    // Index into the solution vector, -1 for the ground node
+    int index(int numNodes) const
+    {
+        if (kind == Kind::SourceCurrent)
+            return numNodes + id;
+        return id - 1;
+    }
+    std::string label() const
+    {
+        switch (kind)
+        {
+        case Kind::NodeVoltage: return "Node" + std::to_string(id);
+        case Kind::JunctionPhase: return "Phase" + std::to_string(id);
+        default: return "Current" + std::to_string(id + 1);
+        }
+    }
+    const char *unit() const
+    {
+        switch (kind)
+        {
+        case Kind::NodeVoltage: return "V";
+        case Kind::JunctionPhase: return "rad";
+        default: return "A";
+        }
+    }
+};
+
+// Receives the solution of every time point instead of Circuit::results,
+// so a long transient does not keep the trajectory in memory
+class ResultSink
+{
+public:
+    virtual ~ResultSink() = default;
+    virtual void begin(int, int) {}
+    virtual void record(double t, const Eigen::VectorXd &x) = 0;
+    virtual void end() {}
 };
 
 // 0 - R01 - 1 - R12 -2 - R23 - 3 - V1 - 0
 // A = [ [ 1/ R01 + 1/ R12] ]
 
+class Resistor;
+class VoltageSource;
+class Capacitor;
+class Inductor;
 class JosephsonJunction;
 
+// Convergence controls of the Newton-Raphson solver. An unknown x_i has converged when
+// |x_i - x_i_prev| <= reltol * max(|x_i|, |x_i_prev|) + its absolute tolerance,
+// which depends on what the unknown is (node voltage, JJ phase or branch current).
+//
+// With modifiedNewton the Jacobian is factorized once and reused (chord iterations
+// x += J0^-1 (z - A x)) across iterations and time steps, as long as the update shrinks by
+// at least maxContraction per iteration; a slower contraction refactorizes at the current
+// point. The converged solution is the same, only the work per iteration changes.
+struct NROptions
+{
+    double reltol = 1e-3;
+    double vntol = 1e-6;    // node voltages [V]
+    double phasetol = 1e-6; // JJ phase nodes [rad]
+    double abstol = 1e-12;  // voltage source branch currents [A]
+    int maxIterations = 100;
+    bool modifiedNewton = false;
+    double maxContraction = 0.3; // |dx_k| / |dx_k-1| above which the Jacobian is refactorized
+
+    // Low-rank mode for circuits whose only nonlinear components are Josephson junctions:
+    // the linear part A0 is factorized once per time step size, and each iteration solves
+    // (A0 + U G V^T) x = z with the Woodbury identity, where junction j contributes the
+    // column e_n1 - e_n2 scaled by Ic cos(phi) in its phase column. Costs one substitution
+    // and O(n k + k^3) per iteration, plus k substitutions when A0 is refactorized.
+    bool lowRankUpdate = false;
+    int maxLowRank = 64; // more junctions than this use the regular Newton iterations
+};
+
+// Step control of the adaptive transient. The local truncation error of every node unknown
+// is estimated from divided differences of the accepted solutions and compared against
+// trtol * (reltol * |x_i| + its NR absolute tolerance), trtol relaxes the NR tolerances.
+struct TransientOptions
+{
+    double reltol = 1e-3;
+    double trtol = 7.0;
+    double minStep = 0.0;   // 0: endTime * 1e-9
+    double maxStep = 0.0;   // 0: endTime / 50
+    double maxGrowth = 2.0; // largest step increase after an accepted step
+};
+
+// Transient state of a circuit at one time point: the solution vector and the value and
+// integration history of every component, in the order they were added. It restores into
+// a circuit of the same topology, e.g. the same netlist loaded again after a restart.
+//
+// Binary file, native byte order:
+//   char magic[8] = "CIRCKPT", uint32 version, uint32 integration method, float64 time,
+//   int32 numNodes, int32 numVoltageSources, uint64 n + n float64 x,
+//   uint64 numComponents + per component uint32 state size, uint64 m + m float64 state
+struct Checkpoint
+{
+    double time = 0.0;
+    int numNodes = 0;
+    int numVoltageSources = 0;
+    IntegrationMethod method = IntegrationMethod::BackwardEuler;
+    Eigen::VectorXd x;
+    std::vector<uint32_t> stateSizes; // values per component, checked on restore
+    std::vector<double> state;
+
+    // Written to filename.tmp and renamed over filename, so an interrupted write keeps the previous checkpoint
+    bool save(const std::string &filename) const
+    {
+        std::string tmp = filename + ".tmp";
+        {
+            std::ofstream file(tmp, std::ios::binary);
+            if (!file.is_open())
+            {
+                std::cerr << "Error: Could not open file " << tmp << std::endl;
+                return false;
+            }
+            uint32_t header[2] = {version, uint32_t(method)};
+            int32_t sizes[2] = {numNodes, numVoltageSources};
+            uint64_t n = x.size(), count = stateSizes.size(), m = state.size();
+            file.write(magic, sizeof(magic));
+            file.write(reinterpret_cast<const char *>(header), sizeof(header));
+            file.write(reinterpret_cast<const char *>(&time), sizeof(time));
+            file.write(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+            file.write(reinterpret_cast<const char *>(&n), sizeof(n));
+            file.write(reinterpret_cast<const char *>(x.data()), n * sizeof(double));
+            file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+            file.write(reinterpret_cast<const char *>(stateSizes.data()), count * sizeof(uint32_t));
+            file.write(reinterpret_cast<const char *>(&m), sizeof(m));
+            file.write(reinterpret_cast<const char *>(state.data()), m * sizeof(double));
+            if (!file.good())
+            {
+                std::cerr << "Error: Could not write checkpoint " << tmp << std::endl;
+                return false;
+            }
+        }
+        if (std::rename(tmp.c_str(), filename.c_str()) != 0)
+        {
+            std::cerr << "Error: Could not rename " << tmp << " to " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool load(const std::string &filename)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return false;
+        }
+        // The counts in the file are checked against the bytes left before anything is sized by them
+        file.seekg(0, std::ios::end);
+        uint64_t length = uint64_t(file.tellg());
+        file.seekg(0);
+        auto fits = [&](uint64_t count, size_t bytes) {
+            return file.good() && count <= (length - uint64_t(file.tellg())) / bytes;
+        };
+
+        char fileMagic[8];
+        uint32_t header[2];
+        int32_t sizes[2];
+        uint64_t n = 0, count = 0, m = 0;
+        file.read(fileMagic, sizeof(fileMagic));
+        file.read(reinterpret_cast<char *>(header), sizeof(header));
+        if (!file.good() || !std::equal(fileMagic, fileMagic + 8, magic) || header[0] != version || header[1] > 2)
+        {
+            std::cerr << "Error: " << filename << " is not a checkpoint of this version" << std::endl;
+            return false;
+        }
+        method = IntegrationMethod(header[1]);
+        file.read(reinterpret_cast<char *>(&time), sizeof(time));
+        file.read(reinterpret_cast<char *>(sizes), sizeof(sizes));
+        numNodes = sizes[0];
+        numVoltageSources = sizes[1];
+        file.read(reinterpret_cast<char *>(&n), sizeof(n));
+        if (!file.good() || sizes[0] < 0 || sizes[1] < 0 || n != uint64_t(sizes[0]) + uint64_t(sizes[1]) || !fits(n, sizeof(double)))
+        {
+            std::cerr << "Error: truncated checkpoint " << filename << std::endl;
+            return false;
+        }
+        x.resize(n);
+        file.read(reinterpret_cast<char *>(x.data()), n * sizeof(double));
+        file.read(reinterpret_cast<char *>(&count), sizeof(count));
+        if (!fits(count, sizeof(uint32_t)))
+        {
+            std::cerr << "Error: truncated checkpoint " << filename << std::endl;
+            return false;
+        }
+        stateSizes.resize(count);
+        file.read(reinterpret_cast<char *>(stateSizes.data()), count * sizeof(uint32_t));
+        file.read(reinterpret_cast<char *>(&m), sizeof(m));
+        uint64_t expected = 0;
+        for (uint32_t size : stateSizes)
+            expected += size;
+        if (!file.good() || m != expected || !fits(m, sizeof(double)))
+        {
+            std::cerr << "Error: truncated checkpoint " << filename << std::endl;
+            return false;
+        }
+        state.resize(m);
+        file.read(reinterpret_cast<char *>(state.data()), m * sizeof(double));
+        if (!file.good())
+        {
+            std::cerr << "Error: truncated checkpoint " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr char magic[8] = {'C', 'I', 'R', 'C', 'K', 'P', 'T', '\0'};
+    static constexpr uint32_t version = 1;
+};
+
+// Solver statistics of a Circuit, cumulative over its runs until resetStats().
+// Only collected when compiled with CIRCUIT_PROFILING defined (cmake -DCIRCUIT_PROFILING=ON),
+// otherwise the timers and counters compile to nothing and the struct stays zero.
+struct SolverStats
+{
+    enum Phase { Stamp, Factor, Solve, Update, Accept, Store, NumPhases };
+    static const char *phaseName(int phase)
+    {
+        static const char *names[NumPhases] = {"stamp", "factor", "solve", "update", "accept", "store"};
+        return names[phase];
+    }
+
+    double phaseSeconds[NumPhases] = {};  // stamping A/z, LU, substitution, NR operating point, state advance, results
+    double totalSeconds = 0.0;             // wall time of the transient and DC runs
+    long factorizations = 0;
+    long symbolicAnalyses = 0;             // sparse pattern analyses
+    long solves = 0;                       // forward/back substitutions or iterative solves
+    long linearIterations = 0;             // Krylov iterations of an iterative solver
+    long nrSolves = 0;
+    long nrIterations = 0;
+    long nrFailures = 0;
+    long reusedJacobians = 0;               // modified Newton iterations without a factorization
+    std::vector<long> nrIterationHistogram; // [k]: NR solves that converged in k iterations
+    long steps = 0;                         // accepted time steps
+    long rejectedSteps = 0;                 // adaptive steps redone with a smaller step
+    int matrixSize = 0;                     // of the last factorization
+    int blocks = 0;                         // independent blocks of the last topology
+    long nonZeros = 0;
+
+    static constexpr bool enabled()
+    {
+#ifdef CIRCUIT_PROFILING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool saveJson(const std::string &filename) const
+    {
+        std::ofstream file(filename);
+        if (!file.is_open())
+        {
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return false;
+        }
+        double other = totalSeconds;
+        file << "{\n  \"enabled\": " << (enabled() ? "true" : "false") << ",\n  \"phase_seconds\": {";
+        for (int p = 0; p < NumPhases; ++p)
+        {
+            file << (p ? ", " : "") << "\"" << phaseName(p) << "\": " << phaseSeconds[p];
+            other -= phaseSeconds[p];
+        }
+        file << ", \"other\": " << std::max(0.0, other) << "},\n"
+             << "  \"total_seconds\": " << totalSeconds << ",\n"
+             << "  \"factorizations\": " << factorizations << ",\n"
+             << "  \"symbolic_analyses\": " << symbolicAnalyses << ",\n"
+             << "  \"solves\": " << solves << ",\n"
+             << "  \"linear_iterations\": " << linearIterations << ",\n"
+             << "  \"nr_solves\": " << nrSolves << ",\n"
+             << "  \"nr_iterations\": " << nrIterations << ",\n"
+             << "  \"nr_failures\": " << nrFailures << ",\n"
+             << "  \"reused_jacobians\": " << reusedJacobians << ",\n"
+             << "  \"nr_iteration_histogram\": [";
+        for (size_t k = 0; k < nrIterationHistogram.size(); ++k)
+            file << (k ? ", " : "") << nrIterationHistogram[k];
+        file << "],\n"
+             << "  \"steps\": " << steps << ",\n"
+             << "  \"rejected_steps\": " << rejectedSteps << ",\n"
+             << "  \"matrix_size\": " << matrixSize << ",\n"
+             << "  \"blocks\": " << blocks << ",\n"
+             << "  \"non_zeros\": " << nonZeros << "\n}\n";
+        return true;
+    }
+};
+
+// Adds the lifetime of the scope to one phase (or the total) of the statistics
+class PhaseTimer
+{
+public:
+    PhaseTimer(double &seconds) : seconds(seconds), start(std::chrono::steady_clock::now()), running(true) {}
+    ~PhaseTimer() { stop(); }
+
+    void stop()
+    {
+        if (running)
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        running = false;
+    }
+
+private:
+    double &seconds;
+    std::chrono::steady_clock::time_point start;
+    bool running;
+};
+
+#ifdef CIRCUIT_PROFILING
+#define CIRCUIT_PROFILE_PHASE(phase) PhaseTimer phaseTimer_(stats.phaseSeconds[SolverStats::phase])
+#define CIRCUIT_PROFILE_RUN() PhaseTimer runTimer_(stats.totalSeconds)
+#define CIRCUIT_PROFILE_END_RUN() (runTimer_.stop(), finishRun())
+#define CIRCUIT_PROFILE(statement) statement
+#else
+#define CIRCUIT_PROFILE_PHASE(phase) ((void)0)
+#define CIRCUIT_PROFILE_RUN() ((void)0)
+#define CIRCUIT_PROFILE_END_RUN() ((void)0)
+#define CIRCUIT_PROFILE(statement) ((void)0)
+#endif
+
+// Structure-of-arrays copy of the netlist grouped by component type, used by the transient
+// loops instead of one virtual call per component. Every stamp goes through an address in A
+// or z resolved once per sparse pattern; a grounded terminal points at `discard`, so the
+// per-type loops have no node > 0 branches. Node voltages are read from `xe`, the solution
+// with a trailing zero for ground. The parameters and integration state are copied in when
+// a transient starts and written back to the components when it ends.
+struct StampPlan
+{
+    // Two terminal conductance stamp, targets A(n1,n1), A(n1,n2), A(n2,n1), A(n2,n2) and z(n1), z(n2)
+    struct Branches
+    {
+        std::vector<int> n1, n2; // indices into xe
+        std::vector<double *> a11, a12, a21, a22, z1, z2;
+        void add(int node1, int node2)
+        {
+            n1.push_back(node1);
+            n2.push_back(node2);
+        }
+        size_t size() const { return n1.size(); }
+        void clear() { *this = Branches(); }
+    };
+
+    std::vector<Resistor *> resistors;
+    Branches resistorBranches;
+    std::vector<double> resistorG;
+
+    std::vector<Capacitor *> capacitors;
+    Branches capacitorBranches;
+    std::vector<double> capC, capV1, capV2, capI1; // C, v(n-1), v(n-2), i(n-1)
+
+    std::vector<Inductor *> inductors;
+    Branches inductorBranches;
+    std::vector<double> indL, indI1, indI2, indV1; // L, i(n-1), i(n-2), v(n-1)
+
+    std::vector<VoltageSource *> sources;
+    std::vector<double *> srcB[4]; // A(n1,row), A(row,n1), A(n2,row), A(row,n2), +1 -1 stamps
+    std::vector<double *> srcZ;
+    std::vector<double> srcValue;
+
+    std::vector<JosephsonJunction *> junctions;
+    Branches junctionBranches;
+    std::vector<int> jjPhase;                                 // index into xe
+    std::vector<double *> jjPP, jjPN1, jjPN2, jjN1P, jjN2P, jjZP; // phase row, cos coupling, phase z
+    std::vector<double> jjIc, jjG, jjC;
+    std::vector<double> jjV1, jjV2, jjDV, jjPhi1, jjPhi2, jjPhiNR;
+
+    std::vector<Component *> others; // components of other types, stamped through the virtual interface
+
+    Eigen::VectorXd xe; // solution plus a ground slot
+    double discard = 0.0;
+    int boundVersion = -1; // pattern version the addresses were resolved for
+    bool bound = false;
+};
 
 // Circuit class for holding the components and solve for the circuit
 class Circuit
 {
 private:
-    std::vector<std::unique_ptr<Component>> components; // a vector of unique pointers to Component  [*componet1, *component2 ...]
-    std::vector<std::vector<double>> A;                 // MNA matrix (combines G and B matrices)   [ [0, 0, 0, 0], [0, 0, 0, 0], [0, 0, 0, 0] ]
-    std::vector<double> z;                              // RHS vector
-    std::vector<double> x;                              // Solution vector (voltages and currents)
+    ComponentArena arena;                               // storage of the emplaced and cloned components, outlives them
+    std::vector<ComponentPtr> components;               // a vector of unique pointers to Component  [*componet1, *component2 ...]
+    MNASystem sys;                                      // MNA matrix A (combines G and B matrices), RHS vector z and solution vector x
     int numNodes;                                       // N
     int numVoltageSources;                              // M
     std::vector<std::pair<double, std::vector<double>>> results; // Stores (time, x) pairs
+    ResultSink *resultSink;                             // if set, receives the results instead of `results`
+
+    // Storage of A and the solver of A x = z, which keeps its factorization (or
+    // preconditioner) across steps while the matrix does not change
+    MNASystem::Mode matrixMode;
+    std::unique_ptr<LinearSolver> linearSolver;
+
+    // Independent blocks of the unknowns, found from the component terminals whenever the
+    // topology changes. With more than one block A is solved block by block.
+    std::unique_ptr<BlockSolver> blockSolver;
+    bool topologyValid;
+    void analyzeTopology();
+    LinearSolver &solver() { return blockSolver ? *blockSolver : *linearSolver; }
+
+    // Newton-Raphson state, the nonlinear components are collected once in addComponent
+    std::vector<Component *> nonlinearComponents;
+    NROptions nrOptions;
+    Eigen::VectorXd nrAbsTol; // absolute tolerance per unknown, rebuilt when the topology changes
+    Eigen::VectorXd prevX;    // previous NR iterate
+
+    // Modified Newton: the factorization held by the linear solver is a Jacobian of solveNR
+    // for this pattern and integration coefficient. Any other factorization clears it.
+    bool jacobianValid;
+    int jacobianPattern;
+    double jacobianA0;
+    Eigen::VectorXd nrResidual, nrDelta;
+    bool solveCorrection(); // x += J0^-1 (z - A x) with the held factorization
+
+    // Woodbury state of NROptions::lowRankUpdate, W = A0^-1 U for the held factorization of A0
+    struct LowRank
+    {
+        std::vector<int> n1, n2, phase;  // unknown indices of every junction, -1 for ground
+        std::vector<double *> coupling;  // A(n1, phase) or A(n2, phase): +-Ic cos(phi) after stampNonlinear
+        std::vector<double> sign;
+        int pattern = -1;                // pattern version of the coupling pointers
+        bool valid = false;              // held factorization is A0 and W matches it
+        double a0 = 0.0;
+        Eigen::MatrixXd W, S;
+        Eigen::VectorXd g, y, q, u, w;
+        Eigen::PartialPivLU<Eigen::MatrixXd> lu;
+    } lowRank;
+    bool useLowRank();
+    bool solveNRLowRank();
+
+    // Pattern built from the DC stamps, and whether the held factorization is its
+    // operating point matrix, see runOperatingPoint
+    bool opFactorValid;
+    int opPattern;
+
+    // Companion model discretization of the transient analyses
+    IntegrationMethod integrationMethod;
+
+    // Type-grouped stamping of the transient loops, holds the component state while active
+    StampPlan plan;
+    bool planActive;
+
+    // Time of the held state, and the time the next transient run starts from
+    double stateTime;
+    double startTime;
+    std::string checkpointFile; // written every checkpointInterval of simulated time during a run
+    double checkpointInterval;
+    double nextCheckpoint;
+    void checkpointIfDue(double t);
+
+    void registerComponent(ComponentPtr component); // node and source counts, nonlinear list, pattern
+
+    // Profiling, see SolverStats
+    SolverStats stats;
+    std::string statsFile; // JSON written at the end of every run if set
+    void recordNR(int iterations, bool converged);
+    void finishRun();
+
+    bool factorSystem();  // LU factorization of the current A
+    bool solveFactored(); // forward/back substitution of the current z into x
+    bool solveSystem();   // factorSystem() followed by solveFactored()
+    void buildRHS();      // restamp only z, A and its factorization are kept
+    void ensurePattern(); // build the sparse pattern from a full stamp including the nonlinear entries
+    void ensureTransientPattern(); // ensurePattern(), replacing the pattern of the DC operating point
+    void buildLinearSystem(); // stamp the linear part of the step and keep it as NR baseline
+    void stampNonlinear();    // baseline plus the linearization of every nonlinear component
+    void updateTolerances();
+    bool hasNonlinearComponents() const;
+    void setStep(double t, double h, double hPrev, bool firstStep); // coefficients of the point t solved with step h
+    void acceptStep();        // advance the state of every component to the current solution
+    void updateOperatingPoints(); // move the nonlinear components to the current solution
+
+    // Stamp phases dispatched to the plan or the virtual component interface
+    void stampComponents(bool matrix, bool rhs, bool nonlinear);
+    void beginPlan();  // group the components and copy in their parameters and state
+    void endPlan();    // write the state back to the components
+    void syncPlan();   // write the state back without leaving the plan
+    bool usePlan();    // plan is active and bound to the current storage
+    void bindPlan();
+    void planStampMatrix();
+    void planStampRHS();
+    void planStampNonlinear();
+    void planAcceptStep();
 
 public:
-    Circuit() : numNodes(0), numVoltageSources(0) {}
+    Circuit() : numNodes(0), numVoltageSources(0), resultSink(nullptr), matrixMode(MNASystem::Mode::Dense), linearSolver(std::make_unique<DirectSolver>()), topologyValid(false), jacobianValid(false), jacobianPattern(-1), jacobianA0(0.0), opFactorValid(false), opPattern(-1), integrationMethod(IntegrationMethod::BackwardEuler), planActive(false), stateTime(0.0), startTime(0.0), checkpointInterval(0.0), nextCheckpoint(0.0) {}
     void addComponent(std::unique_ptr<Component> component); // populate A, z
+    // Construct the component in the circuit's arena, e.g. emplaceComponent<Resistor>(1, 2, 50.0)
+    template <typename T, typename... Args>
+    T *emplaceComponent(Args &&...args)
+    {
+        T *component = arena.create<T>(std::forward<Args>(args)...);
+        registerComponent(ComponentPtr(component, ComponentDeleter(false)));
+        return component;
+    }
     void buildSystem();                                      // populate z
+    void setMatrixMode(MNASystem::Mode mode);                // dense (default) or sparse MNA storage
+    MNASystem::Mode getMatrixMode() const { return matrixMode; }
+    void setLinearSolver(std::unique_ptr<LinearSolver> solver) { linearSolver = std::move(solver); topologyValid = false; } // DirectSolver by default
+    const LinearSolver &getLinearSolver() const { return *linearSolver; }
+    int getNumBlocks() const { return blockSolver ? blockSolver->numBlocks() : 1; } // independent sub-circuits after the last build
     void runTransient(double endTime, double timeStep); // For time-domain analysis
     void runTransient_jj(double endTime, double timeStep); // For time-domain analysis with Josephson Junction
+    bool runTransientAdaptive(double endTime, double initialStep, const TransientOptions &options = TransientOptions()); // LTE controlled step
+    void setIntegrationMethod(IntegrationMethod method) { integrationMethod = method; }
+    IntegrationMethod getIntegrationMethod() const { return integrationMethod; }
     void runDC();
+    // DC operating point with capacitors open, inductors shorted and junctions at zero
+    // voltage. Nonlinear circuits run Newton-Raphson from the held solution, so a sweep
+    // warm-starts from its previous point. With reuseMatrix a linear circuit keeps the
+    // factorization of the previous call and only restamps z, valid while only source
+    // values changed in between. Returns false if no solution was found.
+    bool runOperatingPoint(bool reuseMatrix = false);
     void printA(); // For DC operating point
     void printSolution(); // print the x solution, only for DC
     const std::vector<std::pair<double, std::vector<double>>>& getResults() const;
     void saveResultsToFile(const std::string& filename) const;
     void storeResults(double t); // Store results at time t
-
-    // Newton-Raphson solver for Josephson Junction
-    bool solveNR(std::vector<std::vector<double>>& A, std::vector<double>& z, std::vector<double>& x, JosephsonJunction* jj, double tolerance = 1e-6, int maxIterations = 100);
+    void setResultSink(ResultSink *sink); // stream results to sink (not owned), nullptr to store them in memory again
+    int getNumNodes() const { return numNodes; }
+    int getNumVoltageSources() const { return numVoltageSources; }
+    size_t getNumComponents() const { return components.size(); }
+    void reserve(size_t n) { components.reserve(n); } // before adding many components, e.g. from a netlist
+    const Eigen::VectorXd &getSolution() const { return sys.solution(); } // x of the last solve
+    Component *getComponent(size_t i) { return components[i].get(); } // in the order they were added
+    const Component *getComponent(size_t i) const { return components[i].get(); }
+
+    // Independent copy of the netlist, options, component state, time and solution, without results or sink
+    std::unique_ptr<Circuit> clone() const;
+
+    // Checkpoint/restart. A restored circuit continues its transient runs from the checkpoint
+    // time with the saved integration history, so a shared warm-up is simulated once.
+    Checkpoint getCheckpoint() const;
+    bool restoreCheckpoint(const Checkpoint &checkpoint);
+    bool saveCheckpoint(const std::string &filename) const { return getCheckpoint().save(filename); }
+    bool loadCheckpoint(const std::string &filename);
+    void setCheckpointFile(const std::string &filename, double interval); // periodic checkpoints during runs, "" to stop
+    std::vector<std::unique_ptr<Circuit>> fork(size_t count) const;       // copies continuing from the current state
+    double getTime() const { return stateTime; }                           // time of the held state
+    void setStartTime(double t) { startTime = t; }                         // first time point of the next transient run
+
+    // Newton-Raphson solver for the current time step, iterates on all nonlinear components at once
+    bool solveNR();
+    void setNROptions(const NROptions &options) { nrOptions = options; nrAbsTol.resize(0); }
+    const NROptions &getNROptions() const { return nrOptions; }
+
+    // Per-phase timings and solver counters, all zero unless built with CIRCUIT_PROFILING
+    const SolverStats &getStats() const { return stats; }
+    void resetStats() { stats = SolverStats(); }
+    void setStatsFile(const std::string &filename) { statsFile = filename; } // dump getStats() as JSON after each run
 };
 
 //===----------------------------------------------------------------------===//
@@ -75,6 +1008,7 @@ public:
 // Example component implementations, resistor component
 class Resistor : public Component
 {
+    friend class Circuit; // StampPlan copies the parameters and state
 public:
     Resistor(int n1, int n2, double resistance)
     {
@@ -83,28 +1017,33 @@ public:
         value = resistance;
     }
 
-    void stamp(std::vector<std::vector<double>> &A, std::vector<double> &z,
-               const std::vector<double> &x, int numVoltageSources) override
+    void stampMatrix(MNASystem &sys) const override
     {
         double g = 1.0 / value;
         if (node1 > 0)
         {
-            A[node1 - 1][node1 - 1] += g;
+            sys.addA(node1 - 1, node1 - 1, g);
             if (node2 > 0)
-                A[node1 - 1][node2 - 1] -= g;
+                sys.addA(node1 - 1, node2 - 1, -g);
         }
         if (node2 > 0)
         {
             if (node1 > 0)
-                A[node2 - 1][node1 - 1] -= g;
-            A[node2 - 1][node2 - 1] += g;
+                sys.addA(node2 - 1, node1 - 1, -g);
+            sys.addA(node2 - 1, node2 - 1, g);
         }
     }
+
+    void stampAC(ACStamp &ac, const Eigen::VectorXd &) const override { ACStamp::branch(ac.g, node1, node2, 1.0 / value); }
+
+    std::unique_ptr<Component> clone() const override { return std::make_unique<Resistor>(*this); }
+    Component *cloneInto(ComponentArena &arena) const override { return arena.create<Resistor>(*this); }
 };
 
 // Example component implementation, voltage source component
 class VoltageSource : public Component
 {
+    friend class Circuit; // StampPlan copies the parameters and state
 public:
     VoltageSource(int n1, int n2, double voltage, int vIdx)
     {
@@ -114,114 +1053,245 @@ public:
         voltageIdx = vIdx;
     }
 
-    void stamp(std::vector<std::vector<double>> &A, std::vector<double> &z,
-               const std::vector<double> &x, int numVoltageSources) override
+    void stampMatrix(MNASystem &sys) const override
     {
-        int n = A.size() - numVoltageSources;
+        int n = sys.getNumNodes();
         // Stamp B matrix entries
         if (node1 > 0)
         {
-            A[node1 - 1][n + voltageIdx] += 1.0;
-            A[n + voltageIdx][node1 - 1] += 1.0;
+            sys.addA(node1 - 1, n + voltageIdx, 1.0);
+            sys.addA(n + voltageIdx, node1 - 1, 1.0);
         }
         if (node2 > 0)
         {
-            A[node2 - 1][n + voltageIdx] -= 1.0;
-            A[n + voltageIdx][node2 - 1] -= 1.0;
+            sys.addA(node2 - 1, n + voltageIdx, -1.0);
+            sys.addA(n + voltageIdx, node2 - 1, -1.0);
         }
-        // Stamp source value
-        z[n + voltageIdx] = value;
     }
 
+    void stampRHS(MNASystem &sys) const override
+    {
+        // Stamp source value, at the time of the point being solved for a time dependent source
+        sys.setZ(sys.getNumNodes() + voltageIdx, valueAt(sys.getTime()));
+    }
+
+    double valueAt(double t) const { return waveform ? waveform(t) : value; }
+
     bool isVoltageSource() const override { return true; }
+    // Same B entries as stampMatrix, the excitation is chosen by the analysis
+    void stampAC(ACStamp &ac, const Eigen::VectorXd &) const override
+    {
+        int n = ac.numNodes;
+        if (node1 > 0)
+        {
+            ac.g.emplace_back(node1 - 1, n + voltageIdx, 1.0);
+            ac.g.emplace_back(n + voltageIdx, node1 - 1, 1.0);
+        }
+        if (node2 > 0)
+        {
+            ac.g.emplace_back(node2 - 1, n + voltageIdx, -1.0);
+            ac.g.emplace_back(n + voltageIdx, node2 - 1, -1.0);
+        }
+    }
+    void appendUnknowns(int numNodes, std::vector<int> &unknowns) const override
+    {
+        Component::appendUnknowns(numNodes, unknowns);
+        unknowns.push_back(numNodes + voltageIdx);
+    }
+    std::unique_ptr<Component> clone() const override { return std::make_unique<VoltageSource>(*this); }
+    Component *cloneInto(ComponentArena &arena) const override { return arena.create<VoltageSource>(*this); }
+
+    // Time dependent source v(t), an empty function restores the constant value
+    void setWaveform(std::function<double(double)> v) { waveform = std::move(v); }
+
+private:
+    std::function<double(double)> waveform;
 };
 
 class Capacitor : public Component {
+    friend class Circuit; // StampPlan copies the parameters and state
 private:
-    double prevVoltage; // Voltage across the capacitor at the previous time step
-    double timeStep;    // Time step for the simulation
+    double prevVoltage;  // Voltage across the capacitor at the previous time step
+    double prevVoltage2; // Voltage two steps ago (Gear2)
+    double prevCurrent;  // Current through the capacitor at the previous time step (trapezoidal)
+    double timeStep;     // Default time step, used when the analysis does not provide one
 
 public:
     Capacitor(int n1, int n2, double capacitance, double dt)
-        : prevVoltage(0.0), timeStep(dt) {
+        : prevVoltage(0.0), prevVoltage2(0.0), prevCurrent(0.0), timeStep(dt) {
         node1 = n1;
         node2 = n2;
         value = capacitance; // Capacitance value (C)
     }
 
-    void stamp(std::vector<std::vector<double>> &A, std::vector<double> &z,
-               const std::vector<double> &x, int numVoltageSources) override {
-        double gc = value / timeStep; // Conductance G_C = C / Δt
-        double ic = gc * prevVoltage; // Current source I_C = G_C * V_prev
+    void stampMatrix(MNASystem &sys) const override {
+        if (sys.isOperatingPoint())
+            return; // open at DC
+        double gc = conductance(value, sys.coefficients(timeStep)); // Conductance G_C = C / Δt for backward Euler
 
         // Stamp conductance (similar to a resistor)
         if (node1 > 0) {
-            A[node1 - 1][node1 - 1] += gc;
+            sys.addA(node1 - 1, node1 - 1, gc);
             if (node2 > 0)
-                A[node1 - 1][node2 - 1] -= gc;
+                sys.addA(node1 - 1, node2 - 1, -gc);
         }
         if (node2 > 0) {
             if (node1 > 0)
-                A[node2 - 1][node1 - 1] -= gc;
-            A[node2 - 1][node2 - 1] += gc;
+                sys.addA(node2 - 1, node1 - 1, -gc);
+            sys.addA(node2 - 1, node2 - 1, gc);
         }
+    }
+
+    // Companion model I = G_C * V + history, leaving node1. Static so the stamp plan of the
+    // circuit evaluates the same formulas on its copies of the state.
+    static double conductance(double C, const IntegrationCoeffs &c) { return C * c.a0; }
+    static double history(double C, double v1, double v2, double i1, const IntegrationCoeffs &c) {
+        return C * (c.a1 * v1 + c.a2 * v2) + c.b1 * i1;
+    }
+
+    double historyCurrent(const IntegrationCoeffs &c) const {
+        return history(value, prevVoltage, prevVoltage2, prevCurrent, c);
+    }
+
+    void stampRHS(MNASystem &sys) const override {
+        if (sys.isOperatingPoint())
+            return;
+        double ic = historyCurrent(sys.coefficients(timeStep)); // I_C = -G_C * V_prev for backward Euler
 
         // Stamp current source (RHS vector z)
         if (node1 > 0)
-            z[node1 - 1] -= ic;
+            sys.addZ(node1 - 1, -ic);
         if (node2 > 0)
-            z[node2 - 1] += ic;
+            sys.addZ(node2 - 1, ic);
+    }
+
+    void stampAC(ACStamp &ac, const Eigen::VectorXd &) const override { ACStamp::branch(ac.c, node1, node2, value); }
+
+    double getTimeStep() const { return timeStep; }
+
+    std::unique_ptr<Component> clone() const override { return std::make_unique<Capacitor>(*this); }
+    Component *cloneInto(ComponentArena &arena) const override { return arena.create<Capacitor>(*this); }
+
+    void saveState(std::vector<double> &state) const override {
+        state.insert(state.end(), {value, prevVoltage, prevVoltage2, prevCurrent});
+    }
+    const double *restoreState(const double *state) override {
+        value = state[0];
+        prevVoltage = state[1];
+        prevVoltage2 = state[2];
+        prevCurrent = state[3];
+        return state + 4;
+    }
+    void appendStateKinds(std::vector<StateKind> &kinds) const override {
+        kinds.insert(kinds.end(), {StateKind::Parameter, StateKind::Voltage, StateKind::Voltage, StateKind::Current});
+    }
+
+    void acceptStep(const MNASystem &sys) override {
+        const Eigen::VectorXd &x = sys.solution();
+        IntegrationCoeffs c = sys.coefficients(timeStep);
+        double v = (node1 > 0 ? x[node1 - 1] : 0.0) - (node2 > 0 ? x[node2 - 1] : 0.0);
 
-        // Update previous voltage for the next time step
-        prevVoltage = (node1 > 0 ? x[node1 - 1] : 0.0) - (node2 > 0 ? x[node2 - 1] : 0.0);
+        // Update previous current and voltages for the next time step
+        prevCurrent = conductance(value, c) * v + historyCurrent(c);
+        prevVoltage2 = prevVoltage;
+        prevVoltage = v;
     }
 };
 
 class Inductor : public Component {
+    friend class Circuit; // StampPlan copies the parameters and state
 private:
-    double prevCurrent; // Current through the inductor at the previous time step
-    double timeStep;    // Time step for the simulation
+    double prevCurrent;  // Current through the inductor at the previous time step
+    double prevCurrent2; // Current two steps ago (Gear2)
+    double prevVoltage;  // Voltage across the inductor at the previous time step (trapezoidal)
+    double timeStep;     // Default time step, used when the analysis does not provide one
 
 public:
     Inductor(int n1, int n2, double inductance, double dt)
-        : prevCurrent(0.0), timeStep(dt) {
+        : prevCurrent(0.0), prevCurrent2(0.0), prevVoltage(0.0), timeStep(dt) {
         node1 = n1;
         node2 = n2;
         value = inductance; // Inductance value (L)
     }
 
     // FIXME : to be consistent with QUCS definition of the MNA of the inductor
-    void stamp(std::vector<std::vector<double>> &A, std::vector<double> &z,
-               const std::vector<double> &x, int numVoltageSources) override {
-        double gl = timeStep / value; // Conductance G_L = Δt / L
-        double il = prevCurrent;      // Current source I_L = I_prev
+    void stampMatrix(MNASystem &sys) const override {
+        double gl = sys.isOperatingPoint() ? MNASystem::shortConductance // short at DC
+                                           : conductance(value, sys.coefficients(timeStep)); // Conductance G_L = Δt / L for backward Euler
 
         // Stamp conductance (similar to a resistor)
         if (node1 > 0) {
-            A[node1 - 1][node1 - 1] += gl;
+            sys.addA(node1 - 1, node1 - 1, gl);
             if (node2 > 0)
-                A[node1 - 1][node2 - 1] -= gl;
+                sys.addA(node1 - 1, node2 - 1, -gl);
         }
         if (node2 > 0) {
             if (node1 > 0)
-                A[node2 - 1][node1 - 1] -= gl;
-            A[node2 - 1][node2 - 1] += gl;
+                sys.addA(node2 - 1, node1 - 1, -gl);
+            sys.addA(node2 - 1, node2 - 1, gl);
         }
+    }
 
-        // Stamp current source (RHS vector z)
+    // From V = L dI/dt: I = G_L * V + history, leaving node1
+    static double conductance(double L, const IntegrationCoeffs &c) { return 1.0 / (L * c.a0); }
+    static double history(double L, double i1, double i2, double v1, const IntegrationCoeffs &c) {
+        return -(L * (c.a1 * i1 + c.a2 * i2) + c.b1 * v1) / (L * c.a0);
+    }
+
+    double historyCurrent(const IntegrationCoeffs &c) const {
+        return history(value, prevCurrent, prevCurrent2, prevVoltage, c);
+    }
+
+    void stampRHS(MNASystem &sys) const override {
+        if (sys.isOperatingPoint())
+            return;
+        double il = historyCurrent(sys.coefficients(timeStep)); // Current source I_L = I_prev for backward Euler
+
+        // Stamp current source (RHS vector z), I_L flows out of node1
         if (node1 > 0)
-            z[node1 - 1] += il;
+            sys.addZ(node1 - 1, -il);
         if (node2 > 0)
-            z[node2 - 1] -= il;
+            sys.addZ(node2 - 1, il);
+    }
+
+    void stampAC(ACStamp &ac, const Eigen::VectorXd &) const override { ACStamp::branch(ac.gamma, node1, node2, 1.0 / value); }
+
+    double getTimeStep() const { return timeStep; }
+
+    std::unique_ptr<Component> clone() const override { return std::make_unique<Inductor>(*this); }
+    Component *cloneInto(ComponentArena &arena) const override { return arena.create<Inductor>(*this); }
 
-        // Update previous current for the next time step
-        prevCurrent = (node1 > 0 ? x[node1 - 1] : 0.0) - (node2 > 0 ? x[node2 - 1] : 0.0);
+    void saveState(std::vector<double> &state) const override {
+        state.insert(state.end(), {value, prevCurrent, prevCurrent2, prevVoltage});
+    }
+    const double *restoreState(const double *state) override {
+        value = state[0];
+        prevCurrent = state[1];
+        prevCurrent2 = state[2];
+        prevVoltage = state[3];
+        return state + 4;
+    }
+    void appendStateKinds(std::vector<StateKind> &kinds) const override {
+        kinds.insert(kinds.end(), {StateKind::Parameter, StateKind::Current, StateKind::Current, StateKind::Voltage});
+    }
+
+    void acceptStep(const MNASystem &sys) override {
+        const Eigen::VectorXd &x = sys.solution();
+        IntegrationCoeffs c = sys.coefficients(timeStep);
+        double v = (node1 > 0 ? x[node1 - 1] : 0.0) - (node2 > 0 ? x[node2 - 1] : 0.0);
+
+        // Update previous current for the next time step, I_L = I_prev + G_L * V for backward Euler
+        double current = conductance(value, c) * v + historyCurrent(c);
+        prevCurrent2 = prevCurrent;
+        prevCurrent = current;
+        prevVoltage = v;
     }
 };
 
 
 // Specific to superconducting quantum computing, Josephson Junction
 class JosephsonJunction : public Component {
+    friend class Circuit; // StampPlan copies the parameters and state
 private: 
     // JJ parameters
     double criticalCurrent; // Critical current (I_c)
@@ -230,18 +1300,21 @@ private:
 
     // for NR solver and time evolution 
     double prevVoltage;  // Previous voltage across the junction, in time 
-    double prevVoltage2; // Voltage from two steps ago (for derivative calculation)
+    double prevVoltage2; // Voltage from two steps ago (Gear2)
     double prevDVoltage; // Previous time derivative of voltage across the junction, in time
     double prevPhase;  // Previous phase across the junction, in time
+    double prevPhase2; // Phase from two steps ago (Gear2)
     double prevNRphase; // Previous phase difference across the junction, in the NR solver step
-    double timeStep;     // Time step for the simulation
+    double timeStep;     // Default time step, used when the analysis does not provide one
 
     // extra device property
     int phaseNode;       // Node for the phase variable, an extra node specific to JJ
 
+    static constexpr double phi0 = 2.067833848e-15; // Magnetic flux quantum
+
 public:
     JosephsonJunction(int n1, int n2, int pNode, double ic, double r, double c, double dt)
-        : criticalCurrent(ic), resistance(r), capacitance(c), prevVoltage(0.0), prevVoltage2(0.0), prevDVoltage(0.0), prevPhase(0.0), prevNRphase(0.0), timeStep(dt), phaseNode(pNode) {
+        : criticalCurrent(ic), resistance(r), capacitance(c), prevVoltage(0.0), prevVoltage2(0.0), prevDVoltage(0.0), prevPhase(0.0), prevPhase2(0.0), prevNRphase(0.0), timeStep(dt), phaseNode(pNode) {
         node1 = n1;
         node2 = n2;
     }
@@ -249,69 +1322,200 @@ public:
     int getPhaseNode() const {
         return phaseNode;
     }
+    double getCriticalCurrent() const { return criticalCurrent; }
+    void setCriticalCurrent(double ic) { criticalCurrent = ic; }
 
-    void stamp(std::vector<std::vector<double>> &A, std::vector<double> &z,
-               const std::vector<double> &x, int numVoltageSources) override {
-        // Stamp resistor (R) contribution
-        double g = 1.0 / resistance;
+    bool isNonlinear() const override { return true; }
+    void appendUnknowns(int numNodes, std::vector<int> &unknowns) const override {
+        Component::appendUnknowns(numNodes, unknowns);
+        if (phaseNode > 0) {
+            unknowns.push_back(phaseNode - 1);
+        }
+    }
+    int highestNode() const override { return std::max(Component::highestNode(), phaseNode); }
+    void renumberNodes(const std::vector<int> &map) override {
+        Component::renumberNodes(map);
+        phaseNode = map[phaseNode];
+    }
+
+    // Companion model of the RCJ junction, static so the stamp plan of the circuit evaluates
+    // the same formulas on its copies of the state. The phase row reads
+    // phase - phaseCoupling * V = phaseHistory, the capacitor history current leaves node1.
+    static double phaseCoupling(const IntegrationCoeffs &c) { return 2 * M_PI / phi0 / c.a0; }
+    static double phaseHistory(double phi1, double phi2, double v1, const IntegrationCoeffs &c) {
+        return -(c.a1 * phi1 + c.a2 * phi2 + c.b1 * (2 * M_PI / phi0) * v1) / c.a0;
+    }
+    static double capacitorHistory(double C, double v1, double v2, double dv1, const IntegrationCoeffs &c) {
+        return C * (c.a1 * v1 + c.a2 * v2 + c.b1 * dv1);
+    }
+    static double voltageRate(double v, double v1, double v2, double dv1, const IntegrationCoeffs &c) {
+        return c.a0 * v + c.a1 * v1 + c.a2 * v2 + c.b1 * dv1;
+    }
+
+    // I_c sin(phase) linearized at phi: I_c cos(phi) phase + nonlinearCurrent
+    static double nonlinearConductance(double ic, double phi) { return ic * cos(phi); }
+    static double nonlinearCurrent(double ic, double phi) { return ic * sin(phi) - ic * phi * cos(phi); }
+
+    void stampMatrix(MNASystem &sys) const override {
+        IntegrationCoeffs c = sys.coefficients(timeStep);
+
+        // Stamp resistor (R) contribution
+        double g = 1.0 / resistance;
         if (node1 > 0) {
-            A[node1 - 1][node1 - 1] += g;
+            sys.addA(node1 - 1, node1 - 1, g);
             if (node2 > 0)
-                A[node1 - 1][node2 - 1] -= g;
+                sys.addA(node1 - 1, node2 - 1, -g);
         }
         if (node2 > 0) {
             if (node1 > 0)
-                A[node2 - 1][node1 - 1] -= g;
-            A[node2 - 1][node2 - 1] += g;
+                sys.addA(node2 - 1, node1 - 1, -g);
+            sys.addA(node2 - 1, node2 - 1, g);
         }
 
-        // Stamp capacitor (C) contribution
-        double gc = 2 * capacitance / timeStep; // Conductance G_C = 2*C / Δt
-        double i_sc = -gc * prevVoltage + capacitance * prevDVoltage; // Current source 
+        // Stamp capacitor (C) contribution, open at DC
+        double gc = sys.isOperatingPoint() ? 0.0 : Capacitor::conductance(capacitance, c); // Conductance G_C = 2*C / Δt for trapezoidal
         if (node1 > 0) {
-            A[node1 - 1][node1 - 1] += gc;
+            sys.addA(node1 - 1, node1 - 1, gc);
             if (node2 > 0)
-                A[node1 - 1][node2 - 1] -= gc;
+                sys.addA(node1 - 1, node2 - 1, -gc);
         }
         if (node2 > 0) {
             if (node1 > 0)
-                A[node2 - 1][node1 - 1] -= gc;
-            A[node2 - 1][node2 - 1] += gc;
+                sys.addA(node2 - 1, node1 - 1, -gc);
+            sys.addA(node2 - 1, node2 - 1, gc);
+        }
+
+        // At DC the phase is constant, its row holds V = 0 instead and the phase follows
+        // from the junction current I_c sin(phase)
+        if (phaseNode > 0 && sys.isOperatingPoint()) {
+            if (node1 > 0)
+                sys.addA(phaseNode - 1, node1 - 1, 1.0);
+            if (node2 > 0)
+                sys.addA(phaseNode - 1, node2 - 1, -1.0);
+            return;
         }
+
+        // Stamp phase node equation: dphase/dt = (2 * M_PI / Phi_0) * V, scaled by 1 / a0
+        if (phaseNode > 0) {
+            double k = phaseCoupling(c); // timeStep * 2 * M_PI / 2.0 / Phi_0 for trapezoidal
+            sys.addA(phaseNode - 1, phaseNode - 1, 1.0);
+            if (node1 > 0)
+                sys.addA(phaseNode-1, node1 -1, -k);
+            if (node2 > 0)
+                sys.addA(phaseNode - 1, node2 -1, k);
+        }
+    }
+
+    void stampRHS(MNASystem &sys) const override {
+        if (sys.isOperatingPoint())
+            return; // no history at DC
+        IntegrationCoeffs c = sys.coefficients(timeStep);
+
+        // Stamp capacitor (C) history current source
+        double i_sc = capacitorHistory(capacitance, prevVoltage, prevVoltage2, prevDVoltage, c); // Current source
         if (node1 > 0)
-            z[node1 - 1] -= i_sc;
+            sys.addZ(node1 - 1, -i_sc);
         if (node2 > 0)
-            z[node2 - 1] += i_sc;
+            sys.addZ(node2 - 1, i_sc);
+
+        // Stamp phase node equation RHS, trapezoidal: phase = prevPhase + (pi / Phi_0) * timeStep * (V + V_prev)
+        if (phaseNode > 0)
+            sys.addZ(phaseNode - 1, phaseHistory(prevPhase, prevPhase2, prevVoltage, c));
+    }
+
+    // Linearization of I_c sin(phase) around the NR phase: the cos(phase) coupling into A
+    // and the remaining current source into z, restamped every NR iteration
+    void stampNonlinear(MNASystem &sys) const override {
+        if (phaseNode > 0) {
+            double g = nonlinearConductance(criticalCurrent, prevNRphase);
+            if (node1 > 0)
+                sys.addA(node1 - 1, phaseNode-1, g);
+            if (node2 > 0)
+                sys.addA(node2 - 1, phaseNode-1, -g);
+        }
 
         // Stamp Josephson junction current source (RHS vector z)
-        double i_jj = criticalCurrent * sin(prevNRphase) - criticalCurrent * prevNRphase * cos(prevNRphase);
+        double i_jj = nonlinearCurrent(criticalCurrent, prevNRphase);
         if (node1 > 0)
-            z[node1 - 1] -= i_jj;
+            sys.addZ(node1 - 1, -i_jj);
         if (node2 > 0)
-            z[node2 - 1] += i_jj;
+            sys.addZ(node2 - 1, i_jj);
+    }
 
-        // Stamp phase node equation: V_phase = (2 * M_PI / Phi_0) * V_prev * timeStep
-        if (phaseNode > 0) {
-            A[phaseNode - 1][phaseNode - 1] += 1.0;
-            if (node1 > 0) {
-                A[node1 - 1][phaseNode-1] += criticalCurrent * cos(prevNRphase);
-                A[phaseNode-1][node1 -1] += -timeStep * 2 * M_PI / 2.0 / 2.067833848e-15;
-            }
-            if (node2 > 0) {
-                A[node2 - 1][phaseNode-1] -= criticalCurrent * cos(prevNRphase);
-                A[phaseNode - 1][node2 -1] -= -timeStep * 2 * M_PI / 2.0 / 2.067833848e-15;
-            }
-            z[phaseNode - 1] += -(2 * M_PI / 2.067833848e-15) * prevVoltage * timeStep / 2.0 - prevPhase;
+    void updateOperatingPoint(const Eigen::VectorXd &x) override {
+        if (phaseNode > 0)
+            updateNRPhase(x[phaseNode - 1]);
+    }
+
+    // RCJ model linearized at the bias phase: the phase row holds jw phase = (2 pi / Phi_0) V,
+    // divided by jw, and the phase feeds I_c cos(phase_0) phase into the nodes, so the
+    // junction acts as the Josephson inductance Phi_0 / (2 pi I_c cos(phase_0))
+    void stampAC(ACStamp &ac, const Eigen::VectorXd &x) const override {
+        ACStamp::branch(ac.g, node1, node2, 1.0 / resistance);
+        ACStamp::branch(ac.c, node1, node2, capacitance);
+        double k = 2 * M_PI / phi0;
+        if (phaseNode <= 0) {
+            ACStamp::branch(ac.gamma, node1, node2, k * criticalCurrent * cos(prevNRphase));
+            return;
+        }
+        int p = phaseNode - 1;
+        double gj = criticalCurrent * cos(x[p]);
+        ac.g.emplace_back(p, p, 1.0);
+        if (node1 > 0) {
+            ac.gamma.emplace_back(p, node1 - 1, -k);
+            ac.g.emplace_back(node1 - 1, p, gj);
+        }
+        if (node2 > 0) {
+            ac.gamma.emplace_back(p, node2 - 1, k);
+            ac.g.emplace_back(node2 - 1, p, -gj);
         }
     }
 
-    // Method to update the previous voltage derivative
-    void updatePrevDVoltage(double currentVoltage) {
-        // Calculate the derivative using the previous two voltages
-        prevDVoltage = (currentVoltage - prevVoltage2) / (2 * timeStep);
-        // Update the previous voltages
-        prevVoltage2 = prevVoltage;
-        prevVoltage = currentVoltage;
+    std::unique_ptr<Component> clone() const override { return std::make_unique<JosephsonJunction>(*this); }
+    Component *cloneInto(ComponentArena &arena) const override { return arena.create<JosephsonJunction>(*this); }
+
+    void saveState(std::vector<double> &state) const override {
+        state.insert(state.end(), {value, criticalCurrent, resistance, capacitance, prevVoltage, prevVoltage2,
+                                   prevDVoltage, prevPhase, prevPhase2, prevNRphase});
+    }
+    const double *restoreState(const double *state) override {
+        value = state[0];
+        criticalCurrent = state[1];
+        resistance = state[2];
+        capacitance = state[3];
+        prevVoltage = state[4];
+        prevVoltage2 = state[5];
+        prevDVoltage = state[6];
+        prevPhase = state[7];
+        prevPhase2 = state[8];
+        prevNRphase = state[9];
+        return state + 10;
+    }
+    void appendStateKinds(std::vector<StateKind> &kinds) const override {
+        kinds.insert(kinds.end(), 4, StateKind::Parameter);
+        kinds.insert(kinds.end(), {StateKind::Voltage, StateKind::Voltage, StateKind::Rate,
+                                   StateKind::Phase, StateKind::Phase, StateKind::Phase});
+    }
+
+    void acceptStep(const MNASystem &sys) override {
+        const Eigen::VectorXd &x = sys.solution();
+        IntegrationCoeffs c = sys.coefficients(timeStep);
+
+        // Update the previous voltage and phase for the next time step
+        double currentVoltage = (node1 > 0 ? x[node1 - 1] : 0.0) - (node2 > 0 ? x[node2 - 1] : 0.0);
+        double currentPhase = phaseNode > 0 ? x[phaseNode - 1] : 0.0;
+
+        // Update the previous voltage derivative
+        updatePrevDVoltage(currentVoltage, c);
+
+        // Update the previous voltage and phase in the Josephson Junction
+        updatePhaseAndVoltage(currentVoltage, currentPhase);
+    }
+
+    // Method to update the previous voltage derivative, from the same
+    // derivative approximation the capacitor companion model uses
+    void updatePrevDVoltage(double currentVoltage, const IntegrationCoeffs &c) {
+        prevDVoltage = voltageRate(currentVoltage, prevVoltage, prevVoltage2, prevDVoltage, c);
     }
 
     // Method to set the initial NR phase for the current time step
@@ -326,7 +1530,9 @@ public:
 
     // Method to update the phase and voltage after the NR loop converges
     void updatePhaseAndVoltage(double currentVoltage, double currentPhase) {
+        prevPhase2 = prevPhase;
         prevPhase = currentPhase;
+        prevVoltage2 = prevVoltage;
         prevVoltage = currentVoltage;
     }
 };
@@ -343,206 +1549,1112 @@ void Circuit::buildSystem()
         if (component->isVoltageSource())
             numVoltageSources++;
     }
+    if (!topologyValid)
+        analyzeTopology();
+
+    // Size of MNA matrix is (nodes + voltage sources), A and z are zeroed in place before stamping
+    CIRCUIT_PROFILE_PHASE(Stamp);
+    do
+    {
+        sys.reset(numNodes, numVoltageSources, matrixMode);
+
+        // Stamp each component's contribution, nonlinear ones linearized at their operating point
+        stampComponents(true, true, true);
+    } while (!sys.finishStamping());
+};
+
+// Union-find over the unknowns every component couples. Sub-circuits that only meet at
+// ground end up in different blocks, which BlockSolver factorizes separately. The unknowns
+// keep the user's numbering, so the solution and results need no mapping back.
+void Circuit::analyzeTopology()
+{
+    int n = numNodes + numVoltageSources;
+    std::vector<int> parent(n);
+    for (int i = 0; i < n; ++i)
+        parent[i] = i;
+    auto find = [&parent](int i) {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    };
+
+    std::vector<int> unknowns;
+    for (const auto &component : components)
+    {
+        unknowns.clear();
+        component->appendUnknowns(numNodes, unknowns);
+        for (size_t k = 1; k < unknowns.size(); ++k)
+            parent[find(unknowns[k])] = find(unknowns[0]);
+    }
+
+    // Number the blocks in the order of their first unknown
+    std::vector<int> blockOf(n), blockOfRoot(n, -1);
+    int numBlocks = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        int root = find(i);
+        if (blockOfRoot[root] < 0)
+            blockOfRoot[root] = numBlocks++;
+        blockOf[i] = blockOfRoot[root];
+    }
+
+    if (numBlocks > 1)
+        blockSolver = std::make_unique<BlockSolver>(blockOf, numBlocks, *linearSolver);
+    else
+        blockSolver.reset();
+    topologyValid = true;
+};
+
+void Circuit::ensurePattern()
+{
+    if (!sys.hasPattern() || sys.size() != numNodes + numVoltageSources)
+        buildSystem();
+};
+
+// The DC operating point stamps no open capacitors and no phase coupling, a sparse pattern
+// built there misses the transient entries
+void Circuit::ensureTransientPattern()
+{
+    if (sys.getMode() == MNASystem::Mode::Sparse && sys.getPatternVersion() == opPattern)
+        sys.invalidatePattern();
+    ensurePattern();
+};
+
+void Circuit::buildLinearSystem()
+{
+    ensurePattern();
+    bool inPattern;
+    {
+        CIRCUIT_PROFILE_PHASE(Stamp);
+        sys.reset(numNodes, numVoltageSources, matrixMode);
+        stampComponents(true, true, false);
+        inPattern = sys.finishStamping();
+    }
+    if (!inPattern)
+    {
+        // An entry fell outside the sparse pattern, rebuild it from a full stamp and stamp again
+        buildSystem();
+        buildLinearSystem();
+        return;
+    }
+    sys.saveBaseline();
+};
+
+void Circuit::stampNonlinear()
+{
+    bool inPattern;
+    {
+        CIRCUIT_PROFILE_PHASE(Stamp);
+        sys.restoreBaseline();
+        stampComponents(false, false, true);
+        inPattern = sys.finishStamping();
+    }
+    if (!inPattern)
+    {
+        // An entry fell outside the sparse pattern, rebuild it and stamp again
+        buildLinearSystem();
+        stampNonlinear();
+    }
+};
 
-    // Size of MNA matrix is (nodes + voltage sources)
+// Absolute NR tolerance of each unknown: node voltages, JJ phase nodes, branch currents
+void Circuit::updateTolerances()
+{
     int size = numNodes + numVoltageSources;
-    A.resize(size, std::vector<double>(size, 0.0));
-    z.resize(size, 0.0);
-    x.resize(size, 0.0);
+    nrAbsTol.resize(size);
+    nrAbsTol.head(numNodes).setConstant(nrOptions.vntol);
+    nrAbsTol.tail(numVoltageSources).setConstant(nrOptions.abstol);
+    for (Component *component : nonlinearComponents)
+    {
+        if (auto *jj = dynamic_cast<JosephsonJunction *>(component))
+        {
+            if (jj->getPhaseNode() > 0)
+                nrAbsTol(jj->getPhaseNode() - 1) = nrOptions.phasetol;
+        }
+    }
+};
+
+void Circuit::buildRHS()
+{
+    CIRCUIT_PROFILE_PHASE(Stamp);
+    sys.clearRHS();
+    stampComponents(false, true, false);
+};
+
+bool Circuit::hasNonlinearComponents() const
+{
+    return !nonlinearComponents.empty();
+};
+
+// Gear2 needs two points of history, its first step is taken with backward Euler
+void Circuit::setStep(double t, double h, double hPrev, bool firstStep)
+{
+    IntegrationMethod method = integrationMethod;
+    if (firstStep && method == IntegrationMethod::Gear2)
+        method = IntegrationMethod::BackwardEuler;
+    sys.setTimeStep(method, h, hPrev, t);
+};
+
+void Circuit::acceptStep()
+{
+    CIRCUIT_PROFILE_PHASE(Accept);
+    CIRCUIT_PROFILE(stats.steps++);
+    if (planActive)
+    {
+        planAcceptStep();
+        return;
+    }
+    for (const auto &component : components)
+    {
+        component->acceptStep(sys);
+    }
+};
+
+void Circuit::updateOperatingPoints()
+{
+    CIRCUIT_PROFILE_PHASE(Update);
+    const Eigen::VectorXd &x = sys.solution();
+    if (planActive)
+    {
+        for (size_t k = 0; k < plan.junctions.size(); ++k)
+            plan.jjPhiNR[k] = plan.jjPhase[k] < x.size() ? x[plan.jjPhase[k]] : 0.0;
+        for (Component *component : plan.others)
+            component->updateOperatingPoint(x);
+        return;
+    }
+    for (Component *component : nonlinearComponents)
+    {
+        component->updateOperatingPoint(x);
+    }
+};
+
+void Circuit::stampComponents(bool matrix, bool rhs, bool nonlinear)
+{
+    if (usePlan())
+    {
+        if (matrix)
+            planStampMatrix();
+        if (rhs)
+            planStampRHS();
+        if (nonlinear)
+            planStampNonlinear();
+        return;
+    }
+
+    // Virtual interface: DC, pattern construction, or outside a transient
+    if (planActive)
+        syncPlan();
+    for (const auto &component : components)
+    {
+        if (matrix)
+            component->stampMatrix(sys);
+        if (rhs)
+            component->stampRHS(sys);
+    }
+    if (matrix && sys.isOperatingPoint())
+    {
+        for (int i = 0; i < numNodes; ++i)
+            sys.addA(i, i, MNASystem::gmin); // nodes only reached through open capacitors
+    }
+    if (nonlinear)
+    {
+        for (Component *component : nonlinearComponents)
+        {
+            component->stampNonlinear(sys);
+        }
+    }
+};
+
+//===----------------------------------------------------------------------===//
+// Type-grouped stamping, see StampPlan
+//===----------------------------------------------------------------------===//
+void Circuit::beginPlan()
+{
+    plan = StampPlan();
+    int ground = numNodes + numVoltageSources;
+    auto index = [ground](int node) { return node > 0 ? node - 1 : ground; };
 
-    // Stamp each component's contribution
     for (const auto &component : components)
     {
-        component->stamp(A, z, x, numVoltageSources);
+        Component *c = component.get();
+        if (auto *r = dynamic_cast<Resistor *>(c))
+        {
+            plan.resistors.push_back(r);
+            plan.resistorBranches.add(index(r->node1), index(r->node2));
+            plan.resistorG.push_back(1.0 / r->value);
+        }
+        else if (auto *cap = dynamic_cast<Capacitor *>(c))
+        {
+            plan.capacitors.push_back(cap);
+            plan.capacitorBranches.add(index(cap->node1), index(cap->node2));
+            plan.capC.push_back(cap->value);
+            plan.capV1.push_back(cap->prevVoltage);
+            plan.capV2.push_back(cap->prevVoltage2);
+            plan.capI1.push_back(cap->prevCurrent);
+        }
+        else if (auto *ind = dynamic_cast<Inductor *>(c))
+        {
+            plan.inductors.push_back(ind);
+            plan.inductorBranches.add(index(ind->node1), index(ind->node2));
+            plan.indL.push_back(ind->value);
+            plan.indI1.push_back(ind->prevCurrent);
+            plan.indI2.push_back(ind->prevCurrent2);
+            plan.indV1.push_back(ind->prevVoltage);
+        }
+        else if (auto *v = dynamic_cast<VoltageSource *>(c))
+        {
+            plan.sources.push_back(v);
+            plan.srcValue.push_back(v->value);
+        }
+        else if (auto *jj = dynamic_cast<JosephsonJunction *>(c))
+        {
+            plan.junctions.push_back(jj);
+            plan.junctionBranches.add(index(jj->node1), index(jj->node2));
+            plan.jjPhase.push_back(index(jj->phaseNode));
+            plan.jjIc.push_back(jj->criticalCurrent);
+            plan.jjG.push_back(1.0 / jj->resistance);
+            plan.jjC.push_back(jj->capacitance);
+            plan.jjV1.push_back(jj->prevVoltage);
+            plan.jjV2.push_back(jj->prevVoltage2);
+            plan.jjDV.push_back(jj->prevDVoltage);
+            plan.jjPhi1.push_back(jj->prevPhase);
+            plan.jjPhi2.push_back(jj->prevPhase2);
+            plan.jjPhiNR.push_back(jj->prevNRphase);
+        }
+        else
+        {
+            plan.others.push_back(c);
+        }
+    }
+    plan.xe = Eigen::VectorXd::Zero(ground + 1);
+    planActive = true;
+};
+
+void Circuit::syncPlan()
+{
+    for (size_t k = 0; k < plan.capacitors.size(); ++k)
+    {
+        Capacitor *cap = plan.capacitors[k];
+        cap->prevVoltage = plan.capV1[k];
+        cap->prevVoltage2 = plan.capV2[k];
+        cap->prevCurrent = plan.capI1[k];
     }
+    for (size_t k = 0; k < plan.inductors.size(); ++k)
+    {
+        Inductor *ind = plan.inductors[k];
+        ind->prevCurrent = plan.indI1[k];
+        ind->prevCurrent2 = plan.indI2[k];
+        ind->prevVoltage = plan.indV1[k];
+    }
+    for (size_t k = 0; k < plan.junctions.size(); ++k)
+    {
+        JosephsonJunction *jj = plan.junctions[k];
+        jj->prevVoltage = plan.jjV1[k];
+        jj->prevVoltage2 = plan.jjV2[k];
+        jj->prevDVoltage = plan.jjDV[k];
+        jj->prevPhase = plan.jjPhi1[k];
+        jj->prevPhase2 = plan.jjPhi2[k];
+        jj->prevNRphase = plan.jjPhiNR[k];
+    }
+};
+
+void Circuit::endPlan()
+{
+    if (!planActive)
+        return;
+    syncPlan();
+    planActive = false;
 };
 
-// Default matrix solver set up
-// void Circuit::solve()
-// {
-//     // Solve Ax = z using your preferred linear algebra method
-//     x = LinearSolver->solveLinearSystem(A, z);
-//     // First numNodes elements of x are node voltages
-//     // Remaining elements are branch currents through voltage sources
-// };
+bool Circuit::usePlan()
+{
+    if (!planActive || sys.getTimeStep() <= 0.0 || !sys.hasPattern() || sys.size() != numNodes + numVoltageSources)
+        return false;
+    if (plan.boundVersion != sys.getPatternVersion())
+        bindPlan();
+    return plan.bound;
+};
+
+// Resolve every stamp target to its address in the current storage
+void Circuit::bindPlan()
+{
+    int ground = numNodes + numVoltageSources;
+    bool ok = true;
+    auto a = [&](int row, int col) -> double * {
+        if (row == ground || col == ground)
+            return &plan.discard;
+        double *entry = sys.entry(row, col);
+        ok = ok && entry;
+        return entry;
+    };
+    auto z = [&](int row) { return row == ground ? &plan.discard : sys.rhsEntry(row); };
+    auto bind = [&](StampPlan::Branches &b) {
+        size_t n = b.size();
+        b.a11.resize(n); b.a12.resize(n); b.a21.resize(n); b.a22.resize(n);
+        b.z1.resize(n); b.z2.resize(n);
+        for (size_t k = 0; k < n; ++k)
+        {
+            b.a11[k] = a(b.n1[k], b.n1[k]);
+            b.a12[k] = a(b.n1[k], b.n2[k]);
+            b.a21[k] = a(b.n2[k], b.n1[k]);
+            b.a22[k] = a(b.n2[k], b.n2[k]);
+            b.z1[k] = z(b.n1[k]);
+            b.z2[k] = z(b.n2[k]);
+        }
+    };
+    bind(plan.resistorBranches);
+    bind(plan.capacitorBranches);
+    bind(plan.inductorBranches);
+    bind(plan.junctionBranches);
+
+    for (auto &targets : plan.srcB)
+        targets.clear();
+    plan.srcZ.clear();
+    for (VoltageSource *v : plan.sources)
+    {
+        int row = numNodes + v->voltageIdx;
+        int n1 = v->node1 > 0 ? v->node1 - 1 : ground;
+        int n2 = v->node2 > 0 ? v->node2 - 1 : ground;
+        plan.srcB[0].push_back(a(n1, row));
+        plan.srcB[1].push_back(a(row, n1));
+        plan.srcB[2].push_back(a(n2, row));
+        plan.srcB[3].push_back(a(row, n2));
+        plan.srcZ.push_back(z(row));
+    }
+
+    size_t m = plan.junctions.size();
+    plan.jjPP.resize(m); plan.jjPN1.resize(m); plan.jjPN2.resize(m);
+    plan.jjN1P.resize(m); plan.jjN2P.resize(m); plan.jjZP.resize(m);
+    for (size_t k = 0; k < m; ++k)
+    {
+        int p = plan.jjPhase[k], n1 = plan.junctionBranches.n1[k], n2 = plan.junctionBranches.n2[k];
+        plan.jjPP[k] = a(p, p);
+        plan.jjPN1[k] = a(p, n1);
+        plan.jjPN2[k] = a(p, n2);
+        plan.jjN1P[k] = a(n1, p);
+        plan.jjN2P[k] = a(n2, p);
+        plan.jjZP[k] = z(p);
+    }
+
+    plan.bound = ok;
+    plan.boundVersion = sys.getPatternVersion();
+};
+
+void Circuit::planStampMatrix()
+{
+    IntegrationCoeffs c = sys.coefficients(0.0);
+    auto conductances = [](StampPlan::Branches &b, size_t k, double g) {
+        *b.a11[k] += g;
+        *b.a12[k] -= g;
+        *b.a21[k] -= g;
+        *b.a22[k] += g;
+    };
+
+    StampPlan::Branches &r = plan.resistorBranches;
+    for (size_t k = 0; k < r.size(); ++k)
+        conductances(r, k, plan.resistorG[k]);
+
+    StampPlan::Branches &cap = plan.capacitorBranches;
+    for (size_t k = 0; k < cap.size(); ++k)
+        conductances(cap, k, Capacitor::conductance(plan.capC[k], c));
+
+    StampPlan::Branches &ind = plan.inductorBranches;
+    for (size_t k = 0; k < ind.size(); ++k)
+        conductances(ind, k, Inductor::conductance(plan.indL[k], c));
+
+    for (size_t k = 0; k < plan.sources.size(); ++k)
+    {
+        *plan.srcB[0][k] += 1.0;
+        *plan.srcB[1][k] += 1.0;
+        *plan.srcB[2][k] -= 1.0;
+        *plan.srcB[3][k] -= 1.0;
+    }
+
+    StampPlan::Branches &jj = plan.junctionBranches;
+    double k_phase = JosephsonJunction::phaseCoupling(c);
+    for (size_t k = 0; k < jj.size(); ++k)
+    {
+        conductances(jj, k, plan.jjG[k]);
+        conductances(jj, k, Capacitor::conductance(plan.jjC[k], c));
+        *plan.jjPP[k] += 1.0;
+        *plan.jjPN1[k] -= k_phase;
+        *plan.jjPN2[k] += k_phase;
+    }
+
+    for (Component *component : plan.others)
+        component->stampMatrix(sys);
+};
+
+void Circuit::planStampRHS()
+{
+    IntegrationCoeffs c = sys.coefficients(0.0);
+
+    StampPlan::Branches &cap = plan.capacitorBranches;
+    for (size_t k = 0; k < cap.size(); ++k)
+    {
+        double ic = Capacitor::history(plan.capC[k], plan.capV1[k], plan.capV2[k], plan.capI1[k], c);
+        *cap.z1[k] -= ic;
+        *cap.z2[k] += ic;
+    }
+
+    StampPlan::Branches &ind = plan.inductorBranches;
+    for (size_t k = 0; k < ind.size(); ++k)
+    {
+        double il = Inductor::history(plan.indL[k], plan.indI1[k], plan.indI2[k], plan.indV1[k], c);
+        *ind.z1[k] -= il;
+        *ind.z2[k] += il;
+    }
+
+    double t = sys.getTime();
+    for (size_t k = 0; k < plan.sources.size(); ++k)
+        *plan.srcZ[k] = plan.sources[k]->waveform ? plan.sources[k]->waveform(t) : plan.srcValue[k];
+
+    StampPlan::Branches &jj = plan.junctionBranches;
+    for (size_t k = 0; k < jj.size(); ++k)
+    {
+        double i_sc = JosephsonJunction::capacitorHistory(plan.jjC[k], plan.jjV1[k], plan.jjV2[k], plan.jjDV[k], c);
+        *jj.z1[k] -= i_sc;
+        *jj.z2[k] += i_sc;
+        *plan.jjZP[k] += JosephsonJunction::phaseHistory(plan.jjPhi1[k], plan.jjPhi2[k], plan.jjV1[k], c);
+    }
+
+    for (Component *component : plan.others)
+        component->stampRHS(sys);
+};
+
+void Circuit::planStampNonlinear()
+{
+    StampPlan::Branches &jj = plan.junctionBranches;
+    for (size_t k = 0; k < jj.size(); ++k)
+    {
+        double phi = plan.jjPhiNR[k], ic = plan.jjIc[k];
+        double g = JosephsonJunction::nonlinearConductance(ic, phi);
+        *plan.jjN1P[k] += g;
+        *plan.jjN2P[k] += -g;
+        double i_jj = JosephsonJunction::nonlinearCurrent(ic, phi);
+        *jj.z1[k] -= i_jj;
+        *jj.z2[k] += i_jj;
+    }
+
+    for (Component *component : plan.others)
+    {
+        if (component->isNonlinear())
+            component->stampNonlinear(sys);
+    }
+};
+
+void Circuit::planAcceptStep()
+{
+    IntegrationCoeffs c = sys.coefficients(0.0);
+    Eigen::VectorXd &xe = plan.xe;
+    xe.head(sys.solution().size()) = sys.solution();
+
+    StampPlan::Branches &cap = plan.capacitorBranches;
+    for (size_t k = 0; k < cap.size(); ++k)
+    {
+        double v = xe[cap.n1[k]] - xe[cap.n2[k]];
+        double C = plan.capC[k];
+        plan.capI1[k] = Capacitor::conductance(C, c) * v + Capacitor::history(C, plan.capV1[k], plan.capV2[k], plan.capI1[k], c);
+        plan.capV2[k] = plan.capV1[k];
+        plan.capV1[k] = v;
+    }
+
+    StampPlan::Branches &ind = plan.inductorBranches;
+    for (size_t k = 0; k < ind.size(); ++k)
+    {
+        double v = xe[ind.n1[k]] - xe[ind.n2[k]];
+        double L = plan.indL[k];
+        double il = Inductor::history(L, plan.indI1[k], plan.indI2[k], plan.indV1[k], c);
+        plan.indI2[k] = plan.indI1[k];
+        plan.indI1[k] = Inductor::conductance(L, c) * v + il;
+        plan.indV1[k] = v;
+    }
+
+    StampPlan::Branches &jj = plan.junctionBranches;
+    for (size_t k = 0; k < jj.size(); ++k)
+    {
+        double v = xe[jj.n1[k]] - xe[jj.n2[k]];
+        plan.jjDV[k] = JosephsonJunction::voltageRate(v, plan.jjV1[k], plan.jjV2[k], plan.jjDV[k], c);
+        plan.jjPhi2[k] = plan.jjPhi1[k];
+        plan.jjPhi1[k] = xe[plan.jjPhase[k]];
+        plan.jjV2[k] = plan.jjV1[k];
+        plan.jjV1[k] = v;
+    }
+
+    for (Component *component : plan.others)
+        component->acceptStep(sys);
+};
+
+void Circuit::setMatrixMode(MNASystem::Mode mode)
+{
+    matrixMode = mode;
+    sys.invalidatePattern();
+};
+
+// Hand the stamped matrix to the linear solver in place, no copy of A is made.
+// The direct solver reuses the symbolic analysis of SparseLU as long as the pattern
+// does not change, only the numeric factorization is redone.
+// The factorization is kept until the next call, so solveFactored() can be repeated
+// for every new z of a linear transient.
+bool Circuit::factorSystem()
+{
+    CIRCUIT_PROFILE_PHASE(Factor);
+    CIRCUIT_PROFILE(stats.factorizations++);
+    CIRCUIT_PROFILE(stats.matrixSize = sys.size());
+    CIRCUIT_PROFILE(stats.blocks = getNumBlocks());
+    CIRCUIT_PROFILE(stats.nonZeros = sys.getMode() == MNASystem::Mode::Sparse ? sys.sparseMatrix().nonZeros() : long(sys.size()) * sys.size());
+    if (!topologyValid)
+        analyzeTopology();
+    jacobianValid = false;
+    lowRank.valid = false;
+    opFactorValid = false;
+    LinearSolver &linear = solver();
+    CIRCUIT_PROFILE(long analyses = linear.getAnalyses());
+    bool ok = sys.getMode() == MNASystem::Mode::Sparse ? linear.factor(sys.sparseMatrix(), sys.getPatternVersion())
+                                                       : linear.factor(sys.denseMatrix());
+    CIRCUIT_PROFILE(stats.symbolicAnalyses += linear.getAnalyses() - analyses);
+    return ok;
+};
+
+// Solve for z straight into the solution vector, which also is the initial guess of an
+// iterative solver: the previous time step or NR iterate
+bool Circuit::solveFactored()
+{
+    CIRCUIT_PROFILE_PHASE(Solve);
+    CIRCUIT_PROFILE(stats.solves++);
+    LinearSolver &linear = solver();
+    CIRCUIT_PROFILE(long iterations = linear.getIterations());
+    bool ok = linear.solve(sys.rhs(), sys.solution());
+    CIRCUIT_PROFILE(stats.linearIterations += linear.getIterations() - iterations);
+    return ok;
+};
+
+bool Circuit::solveSystem()
+{
+    return factorSystem() && solveFactored();
+};
 
 void Circuit::runDC() {
-    // Build the MNA system for DC analysis
+    CIRCUIT_PROFILE_RUN();
+
+    // Build the MNA system for DC analysis, no time step
+    sys.clearTimeStep();
     buildSystem();
 
-    // Convert A and z to Eigen matrices
-    Eigen::MatrixXd eigenA(A.size(), A[0].size());
-    Eigen::VectorXd eigenZ(z.size());
+    // Solve the system with the LU of the current matrix mode
+    solveSystem();
+    CIRCUIT_PROFILE_END_RUN();
+}
 
-    // Copy data from std::vector to Eigen matrices
-    for (size_t i = 0; i < A.size(); ++i) {
-        for (size_t j = 0; j < A[i].size(); ++j) {
-            eigenA(i, j) = A[i][j];
+bool Circuit::runOperatingPoint(bool reuseMatrix) {
+    CIRCUIT_PROFILE_RUN();
+    sys.clearTimeStep();
+    sys.setOperatingPoint(true);
+
+    bool ok;
+    if (hasNonlinearComponents()) {
+        // The first call builds a pattern holding the DC stamps, then NR linearizes
+        // around the held solution, or the origin before the first solve
+        if (opPattern != sys.getPatternVersion() || !sys.hasPattern() || sys.size() != numNodes + numVoltageSources) {
+            buildSystem();
+            opPattern = sys.getPatternVersion();
         }
+        updateOperatingPoints();
+        ok = solveNR();
+    } else if (reuseMatrix && opFactorValid && opPattern == sys.getPatternVersion() && sys.size() == numNodes + numVoltageSources) {
+        buildRHS();
+        ok = solveFactored();
+    } else {
+        buildSystem();
+        ok = solveSystem();
+        opFactorValid = ok;
+        opPattern = sys.getPatternVersion();
     }
-    for (size_t i = 0; i < z.size(); ++i) {
-        eigenZ(i) = z[i];
+
+    sys.setOperatingPoint(false);
+    CIRCUIT_PROFILE_END_RUN();
+    return ok;
+}
+
+// Newton Raphson solver for the nonlinear components.
+// The linear part of the step is stamped once, every iteration restores it and adds the
+// linearization of all nonlinear components around the current iterate, so the Jacobian
+// couples every junction. Converged when every unknown passes its own tolerance.
+bool Circuit::solveNR() {
+    if (nrAbsTol.size() != numNodes + numVoltageSources) {
+        updateTolerances();
+    }
+    buildLinearSystem();
+    if (useLowRank()) {
+        return solveNRLowRank();
     }
 
-    // Solve the system using Eigen's LU decomposition
-    Eigen::VectorXd eigenX = eigenA.lu().solve(eigenZ);
+    // A held Jacobian is reusable while only the nonlinear entries changed since
+    double a0 = sys.getTimeStep() > 0.0 ? sys.coefficients(0.0).a0 : (sys.isOperatingPoint() ? -1.0 : 0.0);
+    bool chord = nrOptions.modifiedNewton && jacobianValid && jacobianPattern == sys.getPatternVersion() && jacobianA0 == a0;
+    double lastStep = 0.0;
+
+    for (int iter = 0; iter < nrOptions.maxIterations; ++iter) {
+        // Build the system for the current NR operating point
+        stampNonlinear();
+
+        // Solve the system, keeping the previous iterate for the convergence check
+        prevX = sys.solution();
+        if (chord) {
+            if (!solveCorrection()) {
+                recordNR(iter + 1, false);
+                return false;
+            }
+            CIRCUIT_PROFILE(stats.reusedJacobians++);
+        } else {
+            if (!solveSystem()) {
+                recordNR(iter + 1, false);
+                return false;
+            }
+            jacobianValid = true;
+            jacobianPattern = sys.getPatternVersion();
+            jacobianA0 = a0;
+        }
+        const Eigen::VectorXd &x = sys.solution();
 
-    // Copy the solution back to x
-    x.resize(eigenX.size());
-    for (size_t i = 0; i < eigenX.size(); ++i) {
-        x[i] = eigenX(i);
+        // Move every nonlinear component to the new operating point
+        updateOperatingPoints();
+
+        // Per-unknown convergence check, evaluated lazily without temporaries
+        auto delta = (x - prevX).array().abs();
+        auto bound = nrOptions.reltol * x.array().abs().max(prevX.array().abs()) + nrAbsTol.array();
+        if ((delta <= bound).all()) {
+            recordNR(iter + 1, true);
+            return true;
+        }
+
+        // Keep the Jacobian while the updates contract fast enough, refactorize otherwise
+        if (nrOptions.modifiedNewton) {
+            double step = (x - prevX).norm();
+            chord = std::isfinite(step) && (iter == 0 || step <= nrOptions.maxContraction * lastStep);
+            if (!std::isfinite(step)) {
+                sys.solution() = prevX;
+                updateOperatingPoints();
+            }
+            lastStep = step;
+        }
     }
+
+    recordNR(nrOptions.maxIterations, false);
+    return false;
 }
 
-// Newton Raphson solver for josephson junction
-bool Circuit::solveNR(std::vector<std::vector<double>>& A, std::vector<double>& z, std::vector<double>& x, JosephsonJunction* jj, double tolerance , int maxIterations) {
-    int iter = 0;
-    double error = tolerance + 1;
+// Low-rank mode applies when every nonlinear component is a junction and there are few
+// of them; the junction unknowns and the A entries holding their couplings are collected
+// once per pattern
+bool Circuit::useLowRank() {
+    // At DC the phase columns of A0 are empty, the junction couplings are the only entries
+    if (!nrOptions.lowRankUpdate || sys.isOperatingPoint() || nonlinearComponents.empty() || (int)nonlinearComponents.size() > nrOptions.maxLowRank) {
+        return false;
+    }
+    if (lowRank.pattern == sys.getPatternVersion()) {
+        return true;
+    }
+    lowRank.n1.clear();
+    lowRank.n2.clear();
+    lowRank.phase.clear();
+    lowRank.coupling.clear();
+    lowRank.sign.clear();
+    for (Component *component : nonlinearComponents) {
+        auto *jj = dynamic_cast<JosephsonJunction *>(component);
+        if (!jj) {
+            return false;
+        }
+        if (jj->phaseNode <= 0 || (jj->node1 <= 0 && jj->node2 <= 0)) {
+            continue; // no coupling entries to update
+        }
+        int p = jj->phaseNode - 1, n1 = jj->node1 - 1, n2 = jj->node2 - 1;
+        double *entry = n1 >= 0 ? sys.entry(n1, p) : sys.entry(n2, p);
+        if (!entry) {
+            return false;
+        }
+        lowRank.n1.push_back(n1);
+        lowRank.n2.push_back(n2);
+        lowRank.phase.push_back(p);
+        lowRank.coupling.push_back(entry);
+        lowRank.sign.push_back(n1 >= 0 ? 1.0 : -1.0);
+    }
+    lowRank.pattern = sys.getPatternVersion();
+    lowRank.valid = false;
+    return true;
+}
 
-    while (iter < maxIterations && error > tolerance) {
-        // Build the system for the current NR phase
-        buildSystem();
+// Newton-Raphson with A = A0 + U G V^T: x = y - W (I + G V^T W)^-1 G V^T y, y = A0^-1 z.
+// The linear part has just been stamped by buildLinearSystem, it is factorized (and W
+// rebuilt) only when the pattern or the integration coefficient changed. stampNonlinear()
+// adds the couplings to the system matrix afterwards, y and W stay solves with A0 because
+// a LinearSolver solves with the A of its last factor().
+bool Circuit::solveNRLowRank() {
+    int n = sys.size(), k = lowRank.phase.size();
+    double a0 = sys.getTimeStep() > 0.0 ? sys.coefficients(0.0).a0 : 0.0;
+    if (!lowRank.valid || lowRank.a0 != a0) {
+        if (!factorSystem()) {
+            recordNR(1, false);
+            return false;
+        }
+        lowRank.W.resize(n, k);
+        lowRank.u.resize(n);
+        for (int j = 0; j < k; ++j) {
+            lowRank.u.setZero();
+            if (lowRank.n1[j] >= 0) {
+                lowRank.u[lowRank.n1[j]] = 1.0;
+            }
+            if (lowRank.n2[j] >= 0) {
+                lowRank.u[lowRank.n2[j]] = -1.0;
+            }
+            lowRank.w.setZero(n);
+            if (!solver().solve(lowRank.u, lowRank.w)) {
+                recordNR(1, false);
+                return false;
+            }
+            lowRank.W.col(j) = lowRank.w;
+        }
+        lowRank.valid = true;
+        lowRank.a0 = a0;
+    }
 
-        // Convert A and z to Eigen matrices
-        Eigen::MatrixXd eigenA(A.size(), A[0].size());
-        Eigen::VectorXd eigenZ(z.size());
+    Eigen::VectorXd &x = sys.solution();
+    for (int iter = 0; iter < nrOptions.maxIterations; ++iter) {
+        // z and the junction conductances of the current operating point
+        stampNonlinear();
+        lowRank.g.resize(k);
+        for (int j = 0; j < k; ++j) {
+            lowRank.g[j] = lowRank.sign[j] * *lowRank.coupling[j];
+        }
 
-        // Copy data from std::vector to Eigen matrices
-        for (size_t i = 0; i < A.size(); ++i) {
-            for (size_t j = 0; j < A[i].size(); ++j) {
-                eigenA(i, j) = A[i][j];
+        prevX = x;
+        bool ok;
+        {
+            CIRCUIT_PROFILE_PHASE(Solve);
+            CIRCUIT_PROFILE(stats.solves++);
+            lowRank.y = x;
+            ok = solver().solve(sys.rhs(), lowRank.y);
+
+            // k x k capacitance matrix S = I + G V^T W, V^T picks the phase rows
+            lowRank.S.resize(k, k);
+            lowRank.q.resize(k);
+            for (int i = 0; i < k; ++i) {
+                for (int j = 0; j < k; ++j) {
+                    lowRank.S(i, j) = (i == j ? 1.0 : 0.0) + lowRank.g[i] * lowRank.W(lowRank.phase[i], j);
+                }
+                lowRank.q[i] = lowRank.g[i] * lowRank.y[lowRank.phase[i]];
+            }
+            if (k > 0) {
+                lowRank.lu.compute(lowRank.S);
+                lowRank.q = lowRank.lu.solve(lowRank.q);
+                lowRank.y.noalias() -= lowRank.W * lowRank.q;
             }
+            x = lowRank.y;
         }
-        for (size_t i = 0; i < z.size(); ++i) {
-            eigenZ(i) = z[i];
+        if (!ok || !x.allFinite()) {
+            x = prevX;
+            recordNR(iter + 1, false);
+            return false;
         }
 
-        // Solve the system using Eigen's LU decomposition
-        Eigen::VectorXd eigenX = eigenA.lu().solve(eigenZ);
+        updateOperatingPoints();
 
-        // Calculate the error (difference between current and previous solution)
-        error = 0.0;
-        for (size_t i = 0; i < x.size(); ++i) {
-            error += std::abs(eigenX(i) - x[i]);
+        auto delta = (x - prevX).array().abs();
+        auto bound = nrOptions.reltol * x.array().abs().max(prevX.array().abs()) + nrAbsTol.array();
+        if ((delta <= bound).all()) {
+            recordNR(iter + 1, true);
+            return true;
         }
+    }
 
-        // Update the solution vector
-        for (size_t i = 0; i < x.size(); ++i) {
-            x[i] = eigenX(i);
-        }
+    recordNR(nrOptions.maxIterations, false);
+    return false;
+}
 
-        // Update the NR phase for the next iteration
-        double currentNRPhase = x[jj->getPhaseNode() - 1];
-        jj->updateNRPhase(currentNRPhase);
+bool Circuit::solveCorrection() {
+    CIRCUIT_PROFILE_PHASE(Solve);
+    CIRCUIT_PROFILE(stats.solves++);
+    Eigen::VectorXd &x = sys.solution();
+    nrResidual = sys.rhs();
+    if (sys.getMode() == MNASystem::Mode::Sparse) {
+        nrResidual.noalias() -= sys.sparseMatrix() * x;
+    } else {
+        nrResidual.noalias() -= sys.denseMatrix() * x;
+    }
+    nrDelta.setZero(x.size());
+    LinearSolver &linear = solver();
+    CIRCUIT_PROFILE(long iterations = linear.getIterations());
+    bool ok = linear.solve(nrResidual, nrDelta);
+    CIRCUIT_PROFILE(stats.linearIterations += linear.getIterations() - iterations);
+    x += nrDelta;
+    return ok;
+}
 
-        iter++;
+void Circuit::recordNR(int iterations, bool converged) {
+#ifdef CIRCUIT_PROFILING
+    stats.nrSolves++;
+    stats.nrIterations += iterations;
+    if (!converged) {
+        stats.nrFailures++;
+        return;
+    }
+    if (stats.nrIterationHistogram.size() <= size_t(iterations)) {
+        stats.nrIterationHistogram.resize(iterations + 1);
     }
+    stats.nrIterationHistogram[iterations]++;
+#else
+    (void)iterations;
+    (void)converged;
+#endif
+}
 
-    return (error <= tolerance);
+void Circuit::finishRun() {
+    if (!statsFile.empty()) {
+        stats.saveJson(statsFile);
+    }
 }
 
 
 void Circuit::runTransient_jj(double endTime, double timeStep) {
+    CIRCUIT_PROFILE_RUN();
+
     // Clear previous results
     results.clear();
+    if (resultSink) {
+        resultSink->begin(numNodes, numVoltageSources);
+    }
 
-    // Initialize time
-    double t = 0.0;
+    // Initialize time, 0 unless the circuit continues from a checkpoint
+    double t = startTime;
+    nextCheckpoint = t + checkpointInterval;
+
+    // Size the system, x holds the initial operating point
+    ensureTransientPattern();
+    beginPlan();
 
     // Run transient simulation
     while (t < endTime) {
-        // Find the Josephson Junction in the circuit
-        JosephsonJunction* jj = nullptr;
-        for (const auto& component : components) {
-            if (auto* jjComponent = dynamic_cast<JosephsonJunction*>(component.get())) {
-                jj = jjComponent;
-                break;
-            }
-        }
-
-        if (jj) {
-            // Set the initial NR phase to the previous time step phase
-            jj->setInitialNRPhase();
+        setStep(t + timeStep, timeStep, timeStep, t == 0.0);
 
-            // Solve the system using Newton-Raphson method
-            if (!solveNR(A, z, x, jj)) {
-                std::cerr << "Warning: NR solver did not converge at time " << t << std::endl;
-            }
+        // Start the NR iterations of every nonlinear component from the previous time step
+        updateOperatingPoints();
 
-            // Update the previous voltage and phase for the next time step
-            double currentVoltage = (jj->getNode1() > 0 ? x[jj->getNode1() - 1] : 0.0) - (jj->getNode2() > 0 ? x[jj->getNode2() - 1] : 0.0);
-            double currentPhase = x[jj->getPhaseNode() - 1];
+        // Solve the system using Newton-Raphson method
+        if (!solveNR()) {
+            std::cerr << "Warning: NR solver did not converge at time " << t + timeStep << std::endl;
+        }
 
-            // Update the previous voltage and phase in the Josephson Junction
-            jj->updatePhaseAndVoltage(currentVoltage, currentPhase);
+        // Advance the state of every component
+        acceptStep();
 
-            // Update the previous voltage derivative
-            jj->updatePrevDVoltage(currentVoltage);
-        }
+        // Update time, the solution belongs to the end of the step
+        t += timeStep;
 
         // Store or process the results (e.g., save node voltages for plotting)
         storeResults(t);
+        checkpointIfDue(t);
+    }
+    stateTime = t;
 
-        // Update time
-        t += timeStep;
+    endPlan();
+    if (resultSink) {
+        resultSink->end();
     }
+    CIRCUIT_PROFILE_END_RUN();
 }
 
 
 void Circuit::runTransient(double endTime, double timeStep) {
+    CIRCUIT_PROFILE_RUN();
+
     // Clear previous results
     results.clear();
 
-    // Initialize time
-    double t = 0.0;
+    // Initialize time, 0 unless the circuit continues from a checkpoint
+    double t = startTime;
+    nextCheckpoint = t + checkpointInterval;
 
-    // Run transient simulation
-    while (t < endTime) {
-        // Build the MNA system for the current time step
-        buildSystem();
+    // Without nonlinear components A only depends on the integration coefficients,
+    // factorize it when they change (once, or twice for Gear2) and only restamp z in the loop
+    bool linear = !hasNonlinearComponents();
+    double factoredA0 = 0.0;
 
-        // Convert A and z to Eigen matrices
-        Eigen::MatrixXd eigenA(A.size(), A[0].size());
-        Eigen::VectorXd eigenZ(z.size());
+    // Size the system, x holds the initial operating point
+    ensureTransientPattern();
+    beginPlan();
+    if (resultSink) {
+        resultSink->begin(numNodes, numVoltageSources);
+    }
 
-        // Copy data from std::vector to Eigen matrices
-        for (size_t i = 0; i < A.size(); ++i) {
-            for (size_t j = 0; j < A[i].size(); ++j) {
-                eigenA(i, j) = A[i][j];
+    // Run transient simulation
+    while (t < endTime) {
+        setStep(t + timeStep, timeStep, timeStep, t == 0.0);
+        if (linear) {
+            double a0 = sys.coefficients(timeStep).a0;
+            if (a0 != factoredA0) {
+                buildSystem();
+                if (!factorSystem()) {
+                    break;
+                }
+                factoredA0 = a0;
+            } else {
+                // Restamp the history sources and reuse the cached LU
+                buildRHS();
+            }
+            solveFactored();
+        } else {
+            // Solve the nonlinear system with Newton-Raphson, starting from the previous time step
+            updateOperatingPoints();
+            if (!solveNR()) {
+                std::cerr << "Warning: NR solver did not converge at time " << t + timeStep << std::endl;
             }
         }
-        for (size_t i = 0; i < z.size(); ++i) {
-            eigenZ(i) = z[i];
+
+        // Advance the state of the reactive components
+        acceptStep();
+
+        // Update time, the solution belongs to the end of the step
+        t += timeStep;
+
+        // Store or process the results (e.g., save node voltages for plotting)
+        storeResults(t);
+        checkpointIfDue(t);
+    }
+    stateTime = t;
+
+    endPlan();
+    if (resultSink) {
+        resultSink->end();
+    }
+    CIRCUIT_PROFILE_END_RUN();
+}
+
+// Transient with a variable step. Every step is solved like a fixed step, then its local
+// truncation error is estimated from the divided differences of the last accepted points:
+//   backward Euler  LTE = h^2 * dd2
+//   trapezoidal     LTE = h^3 * dd3 / 2
+//   Gear2           LTE = 4/3 * h^3 * dd3
+// A step whose error ratio exceeds 1, or whose NR does not converge, is rejected and redone
+// with a smaller step, otherwise the next step grows with 0.9 * ratio^(-1/(order+1)).
+// Results are recorded at the accepted time points.
+bool Circuit::runTransientAdaptive(double endTime, double initialStep, const TransientOptions &options) {
+    CIRCUIT_PROFILE_RUN();
+
+    results.clear();
+
+    double span = endTime - startTime;
+    double minStep = options.minStep > 0.0 ? options.minStep : span * 1e-9;
+    double maxStep = options.maxStep > 0.0 ? options.maxStep : span / 50.0;
+    int order = integrationMethod == IntegrationMethod::BackwardEuler ? 1 : 2;
+
+    // Size the system, x holds the initial operating point
+    ensureTransientPattern();
+    if (nrAbsTol.size() != numNodes + numVoltageSources) {
+        updateTolerances();
+    }
+    Eigen::VectorXd &x = sys.solution();
+    beginPlan();
+    if (resultSink) {
+        resultSink->begin(numNodes, numVoltageSources);
+    }
+
+    // Accepted points, most recent first, as many as the divided difference needs
+    std::vector<double> times{startTime};
+    std::vector<Eigen::VectorXd> history{x};
+    storeResults(startTime);
+
+    double t = startTime;
+    nextCheckpoint = t + checkpointInterval;
+    double h = std::min(std::max(initialStep, minStep), maxStep);
+    double hPrev = h;
+    bool ok = true;
+    while (endTime - t > 1e-12 * endTime) {
+        h = std::min(h, endTime - t);
+        setStep(t + h, h, hPrev, times.size() == 1);
+
+        bool converged;
+        if (hasNonlinearComponents()) {
+            updateOperatingPoints();
+            converged = solveNR();
+        } else {
+            buildSystem();
+            converged = solveSystem();
         }
 
-        // Solve the system using Eigen's LU decomposition
-        Eigen::VectorXd eigenX = eigenA.lu().solve(eigenZ);
+        // Error ratio of the step, from the divided difference of order + 1
+        double ratio = 0.0;
+        if (converged && (int)times.size() > order) {
+            std::vector<double> ts{t + h};
+            std::vector<Eigen::ArrayXd> dd{x.head(numNodes).array()};
+            for (int k = 0; k <= order; ++k) {
+                ts.push_back(times[k]);
+                dd.push_back(history[k].head(numNodes).array());
+            }
+            for (int m = 1; m <= order + 1; ++m) {
+                for (int k = 0; k + m < (int)ts.size(); ++k) {
+                    dd[k] = (dd[k] - dd[k + 1]) / (ts[k] - ts[k + m]);
+                }
+            }
+            double scale = integrationMethod == IntegrationMethod::BackwardEuler ? h * h
+                         : integrationMethod == IntegrationMethod::Trapezoidal ? h * h * h / 2.0
+                         : 4.0 / 3.0 * h * h * h;
+            Eigen::ArrayXd bound = options.trtol * (options.reltol * x.head(numNodes).array().abs().max(history[0].head(numNodes).array().abs())
+                                                    + nrAbsTol.head(numNodes).array());
+            ratio = (scale * dd[0].abs() / bound).maxCoeff();
+        }
 
-        // Copy the solution back to x
-        x.resize(eigenX.size());
-        for (size_t i = 0; i < eigenX.size(); ++i) {
-            x[i] = eigenX(i);
+        if (!converged || ratio > 1.0) {
+            // Reject, restart from the last accepted point with a smaller step
+            CIRCUIT_PROFILE(stats.rejectedSteps++);
+            x = history[0];
+            if (h <= minStep) {
+                std::cerr << "Error: time step too small at time " << t << std::endl;
+                ok = false;
+                break;
+            }
+            h = std::max(minStep, converged ? h * std::max(0.25, 0.9 * std::pow(ratio, -1.0 / (order + 1))) : h / 4.0);
+            continue;
         }
 
-        // Store or process the results (e.g., save node voltages for plotting)
+        // Accept the step
+        acceptStep();
+        t += h;
+        checkpointIfDue(t);
         storeResults(t);
+        times.insert(times.begin(), t);
+        history.insert(history.begin(), x);
+        if ((int)times.size() > order + 1) {
+            times.pop_back();
+            history.pop_back();
+        }
 
-        // Update time
-        t += timeStep;
+        hPrev = h;
+        double growth = ratio > 0.0 ? 0.9 * std::pow(ratio, -1.0 / (order + 1)) : options.maxGrowth;
+        h = std::min(maxStep, std::max(minStep, h * std::min(options.maxGrowth, std::max(0.25, growth))));
+    }
+
+    stateTime = t;
+    endPlan();
+    if (resultSink) {
+        resultSink->end();
     }
+    CIRCUIT_PROFILE_END_RUN();
+    return ok;
 }
 
 void Circuit::printA() {
     std::cout << "MNA Matrix (A):" << std::endl;
-    for (const auto& row : A) {
-        for (const auto& element : row) {
-            std::cout << std::setw(10) << std::setprecision(4) << element << " ";
+    Eigen::MatrixXd A = sys.getMode() == MNASystem::Mode::Sparse ? Eigen::MatrixXd(sys.sparseMatrix()) : sys.denseMatrix();
+    for (int i = 0; i < A.rows(); ++i) {
+        for (int j = 0; j < A.cols(); ++j) {
+            std::cout << std::setw(10) << std::setprecision(4) << A(i, j) << " ";
         }
         std::cout << std::endl;
     }
 };
 
 void Circuit::printSolution() {
+    const Eigen::VectorXd &x = sys.solution();
     std::cout << "Solution (x):" << std::endl;
     
     // Print node voltages
@@ -560,8 +2672,18 @@ void Circuit::printSolution() {
 };
 
 void Circuit::storeResults(double t) {
+    CIRCUIT_PROFILE_PHASE(Store);
     // Store the current time and solution vector
-    results.push_back(std::make_pair(t, x));
+    const Eigen::VectorXd &x = sys.solution();
+    if (resultSink) {
+        resultSink->record(t, x);
+        return;
+    }
+    results.emplace_back(t, std::vector<double>(x.data(), x.data() + x.size()));
+};
+
+void Circuit::setResultSink(ResultSink *sink) {
+    resultSink = sink;
 };
 
 const std::vector<std::pair<double, std::vector<double>>>& Circuit::getResults() const {
@@ -580,7 +2702,7 @@ void Circuit::saveResultsToFile(const std::string& filename) const {
     for (int i = 0; i < numNodes; ++i) {
         file << ", Node" << (i + 1);
     }
-    for (int i = numNodes; i < x.size(); ++i) {
+    for (int i = numNodes; i < sys.solution().size(); ++i) {
         file << ", Current" << (i - numNodes + 1);
     }
     file << "\n";
@@ -598,28 +2720,150 @@ void Circuit::saveResultsToFile(const std::string& filename) const {
 };
 
 void Circuit::addComponent(std::unique_ptr<Component> component) {
+    registerComponent(std::move(component));
+};
+
+void Circuit::registerComponent(ComponentPtr component) {
     // Update the number of nodes if necessary
-    numNodes = std::max(numNodes, std::max(component->getNode1(), component->getNode2()));
-    
-    // If the component is a JosephsonJunction, ensure the phase node is considered
-    if (auto* jj = dynamic_cast<JosephsonJunction*>(component.get())) {
-        numNodes = std::max(numNodes, jj->getPhaseNode());
-    }
+    // (a JosephsonJunction also has its phase node)
+    numNodes = std::max(numNodes, component->highestNode());
     
     // If the component is a voltage source, increment the number of voltage sources
     if (component->isVoltageSource()) {
         numVoltageSources++;
     }
+
+    // Keep the nonlinear components at hand for the NR iterations
+    if (component->isNonlinear()) {
+        nonlinearComponents.push_back(component.get());
+    }
+    nrAbsTol.resize(0);
     
-    // Add the component to the list
+    // Add the component to the list, a new topology needs a new sparse pattern
     components.push_back(std::move(component));
+    sys.invalidatePattern();
+    topologyValid = false;
 };
 
-// class LinearSolver
-// {
-// public:
-//     virtual std::vector<double> solveLinearSystem(const std::vector<std::vector<double>> &A, const std::vector<double> &z) = 0;
-// };
+std::unique_ptr<Circuit> Circuit::clone() const {
+    auto copy = std::make_unique<Circuit>();
+    copy->matrixMode = matrixMode;
+    copy->linearSolver = linearSolver->clone();
+    copy->nrOptions = nrOptions;
+    copy->integrationMethod = integrationMethod;
+
+    // The components are copied in order into one block of the copy's arena; the counts
+    // are taken over instead of being derived again component by component
+    copy->arena.reserve(arena.bytesUsed());
+    copy->components.reserve(components.size());
+    for (const auto &component : components) {
+        Component *placed = component->cloneInto(copy->arena);
+        copy->components.push_back(placed ? ComponentPtr(placed, ComponentDeleter(false)) : ComponentPtr(component->clone()));
+        if (copy->components.back()->isNonlinear()) {
+            copy->nonlinearComponents.push_back(copy->components.back().get());
+        }
+    }
+    copy->numNodes = numNodes;
+    copy->numVoltageSources = numVoltageSources;
+
+    // The time and solution of the held state, as restoreCheckpoint sets them, so the copy
+    // continues from where the circuit stopped instead of restarting its time axis
+    copy->sys.solution() = sys.solution();
+    copy->stateTime = stateTime;
+    copy->startTime = stateTime;
+    return copy;
+};
+
+Checkpoint Circuit::getCheckpoint() const {
+    Checkpoint checkpoint;
+    checkpoint.time = stateTime;
+    checkpoint.numNodes = numNodes;
+    checkpoint.numVoltageSources = numVoltageSources;
+    checkpoint.method = integrationMethod;
+    checkpoint.x = sys.solution();
+    checkpoint.x.conservativeResize(numNodes + numVoltageSources);
+    if (sys.solution().size() < checkpoint.x.size()) {
+        checkpoint.x.tail(checkpoint.x.size() - sys.solution().size()).setZero();
+    }
+    for (const auto &component : components) {
+        size_t before = checkpoint.state.size();
+        component->saveState(checkpoint.state);
+        checkpoint.stateSizes.push_back(checkpoint.state.size() - before);
+    }
+    return checkpoint;
+};
+
+// The checkpoint must come from a circuit with the same components in the same order;
+// the counts are checked, the component types only through their state sizes
+bool Circuit::restoreCheckpoint(const Checkpoint &checkpoint) {
+    if (checkpoint.numNodes != numNodes || checkpoint.numVoltageSources != numVoltageSources ||
+        checkpoint.stateSizes.size() != components.size()) {
+        std::cerr << "Error: checkpoint of a different circuit (" << checkpoint.numNodes << " nodes, "
+                  << checkpoint.numVoltageSources << " voltage sources, " << checkpoint.stateSizes.size() << " components)" << std::endl;
+        return false;
+    }
+    std::vector<double> state;
+    for (size_t i = 0; i < components.size(); ++i) {
+        state.clear();
+        components[i]->saveState(state);
+        if (state.size() != checkpoint.stateSizes[i]) {
+            std::cerr << "Error: checkpoint does not match component " << i << std::endl;
+            return false;
+        }
+    }
+
+    const double *position = checkpoint.state.data();
+    for (const auto &component : components) {
+        position = component->restoreState(position);
+    }
+    sys.solution() = checkpoint.x;
+    integrationMethod = checkpoint.method;
+    stateTime = checkpoint.time;
+    startTime = checkpoint.time;
+    nrAbsTol.resize(0);
+    jacobianValid = false;
+    lowRank.valid = false;
+    return true;
+};
+
+bool Circuit::loadCheckpoint(const std::string &filename) {
+    Checkpoint checkpoint;
+    return checkpoint.load(filename) && restoreCheckpoint(checkpoint);
+};
+
+void Circuit::setCheckpointFile(const std::string &filename, double interval) {
+    checkpointFile = filename;
+    checkpointInterval = filename.empty() ? 0.0 : interval;
+};
+
+// Called after every accepted step of a transient run, the plan holds the component
+// state then and is scattered back first
+void Circuit::checkpointIfDue(double t) {
+    if (checkpointInterval <= 0.0 || t < nextCheckpoint * (1.0 - 1e-12)) {
+        return;
+    }
+    if (planActive) {
+        syncPlan();
+    }
+    stateTime = t;
+    saveCheckpoint(checkpointFile);
+    while (nextCheckpoint <= t * (1.0 + 1e-12)) {
+        nextCheckpoint += checkpointInterval;
+    }
+};
+
+// Every copy starts with this circuit's solution, component state and time, and continues
+// from there; e.g. a bias sweep forks the warmed-up circuit and sets one value per copy
+std::vector<std::unique_ptr<Circuit>> Circuit::fork(size_t count) const {
+    Checkpoint checkpoint = getCheckpoint();
+    std::vector<std::unique_ptr<Circuit>> copies;
+    copies.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        copies.push_back(clone());
+        copies.back()->restoreCheckpoint(checkpoint);
+    }
+    return copies;
+};
 
 
 #endif // CIRCUIT_SIMULATOR_H
\ No newline at end of file
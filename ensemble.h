@@ -0,0 +1,279 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "circulator_simulator.h"
+#include "random.h"
+#include "thread_pool.h"
+#include <cstdint>
+
+// ensemble.h
+// Monte Carlo ensembles of transient runs. Every sample is a clone of a prototype circuit
+// which a user callback perturbs (component values, noisy source waveforms) with the
+// random stream of that sample, then it is simulated on a work-stealing pool. The
+// trajectories are not kept: each worker folds them into running mean/variance per probe
+// and time point, and the workers' statistics are merged at the end.
+//
+//   Ensemble mc(circuit, [](Circuit &c, Philox &rng, size_t) {
+//       c.getComponent(1)->setValue(rng.normal(1e-3, 1e-5)); // 1% spread of L
+//   });
+//   mc.runTransient(endTime, timeStep, options);
+//   mc.getStatistics().saveToFile("mc.txt");
+//
+// Sample i draws from Philox(options.seed, i), so a sample is reproducible on its own and
+// does not depend on the number of threads. The merged statistics only differ between
+// thread counts by floating point rounding.
+
+// Online mean and variance (Welford), two accumulators merge with Chan's formula
+struct RunningStats
+{
+    uint64_t count = 0;
+    double mean = 0.0;
+    double m2 = 0.0; // sum of squared deviations from the mean
+
+    void add(double x)
+    {
+        ++count;
+        double delta = x - mean;
+        mean += delta / count;
+        m2 += delta * (x - mean);
+    }
+
+    void merge(const RunningStats &other)
+    {
+        if (other.count == 0)
+            return;
+        uint64_t n = count + other.count;
+        double delta = other.mean - mean;
+        mean += delta * other.count / n;
+        m2 += other.m2 + delta * delta * count * other.count / n;
+        count = n;
+    }
+
+    double variance() const { return count > 1 ? m2 / (count - 1) : 0.0; } // sample variance
+    double stddev() const { return std::sqrt(variance()); }
+};
+
+// Random sequences for noisy sources, e.g. a source fluctuating on a time scale slower
+// than the simulation step
+struct MCSampler
+{
+    enum class Distribution { Normal, Uniform };
+
+    // One value every `interval` from 0 to endTime, uniform values have the same mean and standard deviation
+    static std::vector<double> sample(Philox &rng, double endTime, double interval, double mean, double stddev,
+                                      Distribution type = Distribution::Normal)
+    {
+        size_t count = size_t(std::ceil(endTime / interval)) + 1;
+        std::vector<double> values(count);
+        for (double &v : values)
+        {
+            if (type == Distribution::Normal)
+                v = rng.normal(mean, stddev);
+            else
+                v = mean + stddev * std::sqrt(3.0) * (2.0 * rng.uniform() - 1.0);
+        }
+        return values;
+    }
+
+    // Linear interpolation of the samples, held constant past the last one
+    static std::function<double(double)> waveform(std::vector<double> values, double interval)
+    {
+        return [values = std::move(values), interval](double t) {
+            double position = std::max(0.0, t / interval);
+            size_t i = size_t(position);
+            if (i + 1 >= values.size())
+                return values.back();
+            double f = position - i;
+            return (1.0 - f) * values[i] + f * values[i + 1];
+        };
+    }
+};
+
+// Per time point statistics of the selected probes over all samples
+class EnsembleStatistics
+{
+public:
+    size_t numSamples() const { return samples; }
+    const std::vector<double> &getTimes() const { return times; }
+    const std::vector<Probe> &getProbes() const { return probes; }
+    const RunningStats &at(size_t row, size_t probe) const { return stats[row * probes.size() + probe]; }
+    double mean(size_t row, size_t probe) const { return at(row, probe).mean; }
+    double stddev(size_t row, size_t probe) const { return at(row, probe).stddev(); }
+
+    void saveToFile(const std::string &filename) const
+    {
+        std::ofstream file(filename);
+        if (!file.is_open())
+        {
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return;
+        }
+
+        // Write header
+        file << "Time";
+        for (const auto &probe : probes)
+            file << ", " << probe.label() << " mean, " << probe.label() << " std";
+        file << "\n";
+
+        // Write data
+        for (size_t row = 0; row < times.size(); ++row)
+        {
+            file << times[row];
+            for (size_t p = 0; p < probes.size(); ++p)
+                file << ", " << mean(row, p) << ", " << stddev(row, p);
+            file << "\n";
+        }
+    }
+
+private:
+    friend class EnsembleAccumulator;
+    friend class Ensemble;
+
+    void clear()
+    {
+        samples = 0;
+        times.clear();
+        probes.clear();
+        stats.clear();
+    }
+
+    void merge(const EnsembleStatistics &other)
+    {
+        if (other.times.size() > times.size())
+        {
+            times = other.times;
+            probes = other.probes;
+            stats.resize(times.size() * probes.size());
+        }
+        for (size_t i = 0; i < other.stats.size(); ++i)
+            stats[i].merge(other.stats[i]);
+        samples += other.samples;
+    }
+
+    size_t samples = 0;
+    std::vector<double> times;
+    std::vector<Probe> probes;
+    std::vector<RunningStats> stats; // row major, one row per time point
+};
+
+// Result sink of one worker, adds every run it simulates to its statistics
+class EnsembleAccumulator : public ResultSink
+{
+public:
+    EnsembleAccumulator(const std::vector<Probe> &probes) : selected(probes), row(0), valid(false) {}
+
+    void begin(int numNodes, int numVoltageSources) override
+    {
+        // Resolve the probes to solution indices, all signals if none were selected
+        std::vector<Probe> &probes = statistics.probes;
+        probes = selected;
+        if (probes.empty())
+        {
+            for (int node = 1; node <= numNodes; ++node)
+                probes.push_back(Probe::nodeVoltage(node));
+            for (int v = 0; v < numVoltageSources; ++v)
+                probes.push_back(Probe::sourceCurrent(v));
+        }
+        indices.clear();
+        valid = true;
+        for (const auto &probe : probes)
+        {
+            valid = valid && probe.valid(numNodes, numVoltageSources);
+            indices.push_back(probe.index(numNodes));
+        }
+        row = 0;
+    }
+
+    // A sample whose circuit lacks a probed signal is left out
+    void record(double t, const Eigen::VectorXd &x) override
+    {
+        if (!valid)
+            return;
+        if (row == statistics.times.size())
+        {
+            statistics.times.push_back(t);
+            statistics.stats.resize(statistics.stats.size() + indices.size());
+        }
+        RunningStats *stats = &statistics.stats[row * indices.size()];
+        for (size_t p = 0; p < indices.size(); ++p)
+            stats[p].add(indices[p] >= 0 ? x[indices[p]] : 0.0);
+        ++row;
+    }
+
+    void end() override
+    {
+        if (valid)
+            statistics.samples++;
+    }
+
+    EnsembleStatistics statistics;
+
+private:
+    std::vector<Probe> selected;
+    std::vector<int> indices;
+    size_t row;
+    bool valid;
+};
+
+struct EnsembleOptions
+{
+    size_t samples = 1000;
+    uint64_t seed = RAND_SEED;
+    unsigned threads = 0;      // 0: one per hardware thread
+    std::vector<Probe> probes; // empty: every node voltage and source current
+};
+
+class Ensemble
+{
+public:
+    // Called once per sample on its own clone of the prototype, before the run
+    using Perturbation = std::function<void(Circuit &circuit, Philox &rng, size_t sample)>;
+
+    Ensemble(const Circuit &prototype, Perturbation perturb) : prototype(prototype), perturb(std::move(perturb)) {}
+
+    // Fixed step transient of every sample, Circuit::runTransient with the circuit's integration method.
+    // The samples continue from the time of the prototype, which has to be before endTime
+    void runTransient(double endTime, double timeStep, const EnsembleOptions &options = EnsembleOptions())
+    {
+        statistics.clear();
+        if (!(endTime > prototype.getTime()))
+        {
+            std::cerr << "Error: ensemble end time " << endTime << " is not after the prototype's time " << prototype.getTime() << std::endl;
+            return;
+        }
+        for (const auto &probe : options.probes)
+        {
+            if (!probe.valid(prototype.getNumNodes(), prototype.getNumVoltageSources()))
+            {
+                std::cerr << "Error: ensemble probe " << probe.label() << " is not in the circuit" << std::endl;
+                return;
+            }
+        }
+        ThreadPool pool(options.threads);
+        std::vector<std::unique_ptr<EnsembleAccumulator>> accumulators;
+        for (unsigned w = 0; w < pool.size(); ++w)
+            accumulators.push_back(std::make_unique<EnsembleAccumulator>(options.probes));
+
+        pool.parallelFor(options.samples, [&](size_t sample, unsigned worker) {
+            std::unique_ptr<Circuit> circuit = prototype.clone();
+            Philox rng(options.seed, sample);
+            if (perturb)
+                perturb(*circuit, rng, sample);
+            circuit->setResultSink(accumulators[worker].get());
+            circuit->runTransient(endTime, timeStep);
+        });
+
+        statistics.clear();
+        for (const auto &accumulator : accumulators)
+            statistics.merge(accumulator->statistics);
+    }
+
+    const EnsembleStatistics &getStatistics() const { return statistics; }
+
+private:
+    const Circuit &prototype;
+    Perturbation perturb;
+    EnsembleStatistics statistics;
+};
+
+#endif // ENSEMBLE_H
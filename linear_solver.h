@@ -0,0 +1,843 @@
+#ifndef LINEAR_SOLVER_H
+#define LINEAR_SOLVER_H
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <utility> // std::index_sequence
+#include <vector>
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+// linear_solver.h
+// Solvers of the MNA system A x = z. A Circuit owns one LinearSolver and calls factor()
+// whenever A changes and solve() for every new z, so a direct solver keeps its LU across
+// the steps of a linear transient and an iterative solver keeps its preconditioner.
+//
+//   circuit.setLinearSolver(std::make_unique<DirectSolver>());                 // default
+//   circuit.setLinearSolver(std::make_unique<IterativeSolver>(IterativeOptions{
+//       IterativeOptions::Method::GMRES, IterativeOptions::Preconditioner::Jacobi}));
+//   circuit.setLinearSolver(std::make_unique<MixedPrecisionSolver>());         // float LU, refined
+//
+// Iterative solvers start from the x passed in, which the circuit leaves at the solution
+// of the previous step or NR iterate, and need neither the memory nor the fill of an LU.
+
+// LU with partial pivoting of small dense systems (jj_main and the voltage divider are 3x3).
+// The factors live in fixed-size arrays and every size up to MaxSize has its own
+// instantiation, whose loops the compiler fully unrolls; compute() dispatches on the
+// runtime size, so a transient of a tiny circuit runs without heap traffic or dynamic loops.
+class SmallDenseLU
+{
+public:
+    static constexpr int MaxSize = 8;
+
+    static bool supports(int n) { return n >= 1 && n <= MaxSize; }
+
+    // Factorize the n x n column-major matrix a, false if it is singular
+    bool compute(const Eigen::MatrixXd &a)
+    {
+        n = a.rows();
+        return table().factor[n](a.data(), lu, perm);
+    }
+
+    void solve(const Eigen::VectorXd &b, Eigen::VectorXd &x) const
+    {
+        x.resize(b.size()); // no-op when the caller sized x, the kernel writes through x.data()
+        table().solve[n](lu, perm, b.data(), x.data());
+    }
+
+private:
+    template <int N>
+    static bool factor(const double *a, double *lu, int *perm)
+    {
+        // lu is row-major: row i starts at lu + i * N
+        for (int i = 0; i < N; ++i)
+            for (int j = 0; j < N; ++j)
+                lu[i * N + j] = a[j * N + i];
+        for (int i = 0; i < N; ++i)
+            perm[i] = i;
+
+        for (int k = 0; k < N; ++k)
+        {
+            int pivot = k;
+            for (int i = k + 1; i < N; ++i)
+                if (std::abs(lu[i * N + k]) > std::abs(lu[pivot * N + k]))
+                    pivot = i;
+            if (lu[pivot * N + k] == 0.0)
+                return false;
+            if (pivot != k)
+            {
+                for (int j = 0; j < N; ++j)
+                    std::swap(lu[k * N + j], lu[pivot * N + j]);
+                std::swap(perm[k], perm[pivot]);
+            }
+            double inv = 1.0 / lu[k * N + k];
+            for (int i = k + 1; i < N; ++i)
+            {
+                double l = lu[i * N + k] * inv;
+                lu[i * N + k] = l;
+                for (int j = k + 1; j < N; ++j)
+                    lu[i * N + j] -= l * lu[k * N + j];
+            }
+        }
+        return true;
+    }
+
+    template <int N>
+    static void solveN(const double *lu, const int *perm, const double *b, double *x)
+    {
+        double y[N];
+        for (int i = 0; i < N; ++i)
+        {
+            double sum = b[perm[i]];
+            for (int j = 0; j < i; ++j)
+                sum -= lu[i * N + j] * y[j];
+            y[i] = sum;
+        }
+        for (int i = N - 1; i >= 0; --i)
+        {
+            double sum = y[i];
+            for (int j = i + 1; j < N; ++j)
+                sum -= lu[i * N + j] * x[j];
+            x[i] = sum / lu[i * N + i];
+        }
+    }
+
+    using FactorFn = bool (*)(const double *, double *, int *);
+    using SolveFn = void (*)(const double *, const int *, const double *, double *);
+    struct Table
+    {
+        FactorFn factor[MaxSize + 1];
+        SolveFn solve[MaxSize + 1];
+    };
+
+    template <size_t... I>
+    static Table makeTable(std::index_sequence<I...>)
+    {
+        return {{nullptr, &factor<int(I) + 1>...}, {nullptr, &solveN<int(I) + 1>...}};
+    }
+
+    static const Table &table()
+    {
+        static const Table t = makeTable(std::make_index_sequence<MaxSize>());
+        return t;
+    }
+
+    int n = 0;
+    double lu[MaxSize * MaxSize];
+    int perm[MaxSize];
+};
+
+class LinearSolver
+{
+public:
+    virtual ~LinearSolver() = default;
+
+    // Prepare for solves with A. patternVersion identifies the sparsity pattern, work that
+    // only depends on the pattern (symbolic analysis) is redone when it changes. solve()
+    // uses this A even if the caller stamps into its matrix afterwards.
+    virtual bool factor(const Eigen::MatrixXd &A) = 0;
+    virtual bool factor(const Eigen::SparseMatrix<double> &A, int patternVersion) = 0;
+
+    // Solve A x = b with the last factored A, x holds the initial guess on entry
+    virtual bool solve(const Eigen::VectorXd &b, Eigen::VectorXd &x) = 0;
+
+    // Same configuration, no factorization
+    virtual std::unique_ptr<LinearSolver> clone() const = 0;
+
+    // Cumulative counters, read by the solver statistics of the circuit
+    long getAnalyses() const { return analyses; }   // symbolic analyses
+    long getIterations() const { return iterations; } // Krylov iterations or refinement steps
+
+protected:
+    long analyses = 0;
+    long iterations = 0;
+};
+
+// Dense LU with partial pivoting (fixed-size up to SmallDenseLU::MaxSize) or sparse LU
+// with the symbolic analysis kept while the pattern does not change
+class DirectSolver : public LinearSolver
+{
+public:
+    bool factor(const Eigen::MatrixXd &A) override
+    {
+        sparse = false;
+        small = SmallDenseLU::supports(A.rows());
+        if (small)
+        {
+            if (!smallLU.compute(A))
+            {
+                std::cerr << "Error: dense LU factorization failed: singular matrix" << std::endl;
+                return false;
+            }
+            return true;
+        }
+        denseLU.compute(A);
+        return true;
+    }
+
+    bool factor(const Eigen::SparseMatrix<double> &A, int patternVersion) override
+    {
+        sparse = true;
+        if (analyzedPattern != patternVersion)
+        {
+            sparseLU.analyzePattern(A);
+            analyzedPattern = patternVersion;
+            analyses++;
+        }
+        sparseLU.factorize(A);
+        if (sparseLU.info() != Eigen::Success)
+        {
+            std::cerr << "Error: sparse LU factorization failed: " << sparseLU.lastErrorMessage() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Forward/back substitution straight into x
+    bool solve(const Eigen::VectorXd &b, Eigen::VectorXd &x) override
+    {
+        if (sparse)
+            x = sparseLU.solve(b);
+        else if (small)
+            smallLU.solve(b, x);
+        else
+            x = denseLU.solve(b);
+        return true;
+    }
+
+    std::unique_ptr<LinearSolver> clone() const override { return std::make_unique<DirectSolver>(); }
+
+private:
+    bool sparse = false;
+    bool small = false;
+    Eigen::PartialPivLU<Eigen::MatrixXd> denseLU;
+    SmallDenseLU smallLU;
+    Eigen::SparseLU<Eigen::SparseMatrix<double>> sparseLU;
+    int analyzedPattern = -1; // pattern version of the last symbolic analysis, -1 for none
+};
+
+struct MixedPrecisionOptions
+{
+    int maxRefinements = 10;   // refinement steps per solve before falling back
+    double tolerance = 1e-15;  // |b - A x| relative to |A| |x| + |b|, in the max norm
+    double minReduction = 0.5; // a step has to shrink the residual by this factor, else it stalls
+};
+
+// LU in single precision with iterative refinement in double: x += LU^-1 (b - A x), where
+// the residual uses the double A. The float LU is factorized in place and takes half the
+// memory of the factors of DirectSolver, the residuals keep a double copy of A on top, and
+// large factorizations are faster, while every solve needs one or two refinements to reach
+// the double accuracy of a well conditioned system, so it suits circuits that refactorize
+// often (NR iterations) more than a fixed matrix solved every step. When the refinement stalls (ill conditioned JJ systems, values beyond the
+// float range) the same A is factorized in double for the remaining solves; the next
+// factor() tries single precision again. Systems up to SmallDenseLU::MaxSize stay in double.
+// Rows and columns are scaled by powers of two before the conversion, which keeps the
+// KCL rows and the junction phase rows of MNA within the float range and lowers the
+// condition number the refinement has to overcome.
+class MixedPrecisionSolver : public LinearSolver
+{
+public:
+    explicit MixedPrecisionSolver(const MixedPrecisionOptions &options = MixedPrecisionOptions()) : options(options) {}
+
+    bool factor(const Eigen::MatrixXd &A) override
+    {
+        sparse = false;
+        fallback = false;
+        if (SmallDenseLU::supports(A.rows()))
+            return useDouble(A);
+        int n = A.rows();
+        denseA.resize(n, n);
+        Eigen::VectorXd &rowSums = work;
+        rowSums.setZero(n);
+        rowScale.setZero(n);
+        colScale.setZero(n);
+        for (int j = 0; j < n; ++j)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                double v = A(i, j);
+                denseA(i, j) = v;
+                rowSums[i] += std::abs(v);
+                rowScale[i] = std::max(rowScale[i], std::abs(v));
+            }
+        }
+        norm = rowSums.maxCoeff();
+        toPowerOfTwo(rowScale);
+        for (int j = 0; j < n; ++j)
+            for (int i = 0; i < n; ++i)
+                colScale[j] = std::max(colScale[j], std::abs(rowScale[i] * A(i, j)));
+        toPowerOfTwo(colScale);
+
+        denseF.resize(n, n);
+        bool finite = true;
+        for (int j = 0; j < n; ++j)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                double v = rowScale[i] * A(i, j) * colScale[j];
+                finite = finite && std::isfinite(v);
+                denseF(i, j) = float(v);
+            }
+        }
+        if (!finite)
+            return useDouble(A);
+        // In place, denseF holds the factors
+        denseLU = std::make_unique<Eigen::PartialPivLU<Eigen::Ref<Eigen::MatrixXf>>>(denseF);
+        return true;
+    }
+
+    bool factor(const Eigen::SparseMatrix<double> &A, int patternVersion) override
+    {
+        sparse = true;
+        fallback = false;
+        if (pattern == patternVersion && sparseA.nonZeros() == A.nonZeros())
+            std::copy(A.valuePtr(), A.valuePtr() + A.nonZeros(), sparseA.valuePtr());
+        else
+            sparseA = A;
+        pattern = patternVersion;
+        int n = A.rows();
+        Eigen::VectorXd &rowSums = work;
+        rowSums.setZero(n);
+        rowScale.setZero(n);
+        colScale.setZero(n);
+        for (int col = 0; col < A.outerSize(); ++col)
+        {
+            for (Eigen::SparseMatrix<double>::InnerIterator it(A, col); it; ++it)
+            {
+                rowSums[it.row()] += std::abs(it.value());
+                rowScale[it.row()] = std::max(rowScale[it.row()], std::abs(it.value()));
+            }
+        }
+        norm = n > 0 ? rowSums.maxCoeff() : 0.0;
+        toPowerOfTwo(rowScale);
+        for (int col = 0; col < A.outerSize(); ++col)
+            for (Eigen::SparseMatrix<double>::InnerIterator it(A, col); it; ++it)
+                colScale[col] = std::max(colScale[col], std::abs(rowScale[it.row()] * it.value()));
+        toPowerOfTwo(colScale);
+
+        // Keep the float copy and its symbolic analysis while the pattern does not change
+        bool analyze = analyzedPattern != patternVersion;
+        if (analyze)
+        {
+            sparseF = A.cast<float>();
+            sparseF.makeCompressed();
+        }
+        bool finite = true;
+        float *values = sparseF.valuePtr();
+        for (int col = 0; col < A.outerSize(); ++col)
+        {
+            for (Eigen::SparseMatrix<double>::InnerIterator it(A, col); it; ++it)
+            {
+                double v = rowScale[it.row()] * it.value() * colScale[col];
+                finite = finite && std::isfinite(v);
+                *values++ = float(v);
+            }
+        }
+        if (!finite)
+            return useDouble();
+        if (analyze)
+        {
+            sparseLU.analyzePattern(sparseF);
+            analyzedPattern = patternVersion;
+            analyses++;
+        }
+        sparseLU.factorize(sparseF);
+        if (sparseLU.info() != Eigen::Success)
+            return useDouble();
+        return true;
+    }
+
+    bool solve(const Eigen::VectorXd &b, Eigen::VectorXd &x) override
+    {
+        if (fallback)
+            return exact.solve(b, x);
+
+        // Start from the guess in x, the previous step or NR iterate, or from zero
+        if (x.size() != b.size() || !x.allFinite())
+            x = Eigen::VectorXd::Zero(b.size());
+        double bNorm = b.lpNorm<Eigen::Infinity>();
+        if (x.isZero(0.0))
+            r = b;
+        else
+            residual(b, x);
+        double before = r.lpNorm<Eigen::Infinity>();
+        for (int k = 0; k <= options.maxRefinements; ++k)
+        {
+            if (before <= options.tolerance * (norm * x.lpNorm<Eigen::Infinity>() + bNorm))
+                return true;
+            if (k == options.maxRefinements)
+                break;
+            rf = r.cwiseProduct(rowScale).cast<float>();
+            df = sparse ? Eigen::VectorXf(sparseLU.solve(rf)) : Eigen::VectorXf(denseLU->solve(rf));
+            x += df.cast<double>().cwiseProduct(colScale);
+            residual(b, x);
+            double after = r.lpNorm<Eigen::Infinity>();
+            iterations++;
+            if (!(after <= options.minReduction * before))
+                break; // stalled, or the float LU produced no finite correction
+            before = after;
+        }
+
+        // Double precision for this A from here on
+        if (!(sparse ? useDouble() : useDouble(denseA)))
+            return false;
+        return exact.solve(b, x);
+    }
+
+    std::unique_ptr<LinearSolver> clone() const override { return std::make_unique<MixedPrecisionSolver>(options); }
+
+    const MixedPrecisionOptions &getOptions() const { return options; }
+    long getFallbacks() const { return fallbacks; } // matrices factorized in double instead
+
+private:
+    // Powers of two closest to 1 / max, so scaling by them is exact; 1 for an empty row or column
+    static void toPowerOfTwo(Eigen::VectorXd &max)
+    {
+        for (Eigen::Index i = 0; i < max.size(); ++i)
+            max[i] = max[i] > 0.0 && std::isfinite(max[i]) ? std::ldexp(1.0, -std::ilogb(max[i])) : 1.0;
+    }
+
+    bool useDouble(const Eigen::MatrixXd &A)
+    {
+        fallback = true;
+        fallbacks += !SmallDenseLU::supports(A.rows());
+        return exact.factor(A);
+    }
+    bool useDouble()
+    {
+        fallback = true;
+        fallbacks++;
+        long before = exact.getAnalyses();
+        bool ok = exact.factor(sparseA, pattern);
+        analyses += exact.getAnalyses() - before;
+        return ok;
+    }
+
+    // r = b - A x with the double A
+    void residual(const Eigen::VectorXd &b, const Eigen::VectorXd &x)
+    {
+        if (sparse)
+            r.noalias() = b - sparseA * x;
+        else
+            r.noalias() = b - denseA * x;
+    }
+
+    MixedPrecisionOptions options;
+    bool sparse = false;
+    bool fallback = false;  // the current A is solved by exact
+    Eigen::MatrixXd denseA; // A in double for the residuals, it may change before the next factor()
+    Eigen::SparseMatrix<double> sparseA;
+    double norm = 0.0;      // |A| in the max norm
+    Eigen::VectorXd rowScale, colScale; // the float LU factorizes diag(rowScale) A diag(colScale)
+    Eigen::MatrixXf denseF; // scaled A in float, overwritten by its LU
+    std::unique_ptr<Eigen::PartialPivLU<Eigen::Ref<Eigen::MatrixXf>>> denseLU;
+    Eigen::SparseMatrix<float> sparseF;
+    Eigen::SparseLU<Eigen::SparseMatrix<float>> sparseLU;
+    int analyzedPattern = -1; // pattern version of the float symbolic analysis
+    int pattern = -1;         // pattern version of the current A
+    DirectSolver exact;
+    long fallbacks = 0;
+
+    // Work vectors, kept between solves
+    Eigen::VectorXd r, work;
+    Eigen::VectorXf rf, df;
+};
+
+struct IterativeOptions
+{
+    enum class Method { BiCGSTAB, GMRES };
+    enum class Preconditioner { ILU, Jacobi };
+
+    Method method = Method::BiCGSTAB;
+    Preconditioner preconditioner = Preconditioner::ILU;
+    double tolerance = 1e-10;   // on the residual relative to |b|
+    int maxIterations = 1000;
+    int restart = 30;           // Krylov dimension of GMRES between restarts
+    double dropTolerance = 1e-4; // ILUT: entries below it (relative to the row) are dropped
+    int fillFactor = 10;         // ILUT: fill per row relative to A
+};
+
+// Preconditioned BiCGSTAB or restarted GMRES on a copy of the matrix taken in factor(),
+// so solve() uses the factored A like every other backend. ILU is the thresholded incomplete LU of Eigen
+// (IncompleteLUT), Jacobi the inverse diagonal; the voltage source rows of MNA have no
+// diagonal and are left unscaled by Jacobi, which therefore suits RC/RLC meshes with
+// few sources. GMRES is right preconditioned, so its residual is the true one.
+class IterativeSolver : public LinearSolver
+{
+public:
+    explicit IterativeSolver(const IterativeOptions &options = IterativeOptions()) : options(options) {}
+
+    bool factor(const Eigen::MatrixXd &A) override
+    {
+        copy = A.sparseView();
+        return prepare(copy);
+    }
+
+    bool factor(const Eigen::SparseMatrix<double> &A, int) override
+    {
+        // ILUT has no separate symbolic phase worth keeping, the preconditioner is rebuilt.
+        // A is copied: the caller may stamp into its matrix between factor() and solve(),
+        // chord iterations and the Woodbury update rely on solving with the factored A
+        copy = A;
+        return prepare(copy);
+    }
+
+    bool solve(const Eigen::VectorXd &b, Eigen::VectorXd &x) override
+    {
+        const Eigen::SparseMatrix<double> &A = copy;
+        if (x.size() != b.size() || !x.allFinite())
+            x = Eigen::VectorXd::Zero(b.size());
+        double bNorm = b.norm();
+        if (bNorm == 0.0)
+        {
+            x.setZero();
+            return true;
+        }
+        double residual = options.method == IterativeOptions::Method::GMRES ? gmres(A, b, x, bNorm) : bicgstab(A, b, x, bNorm);
+        if (!(residual <= options.tolerance))
+        {
+            std::cerr << "Error: iterative solver did not converge, relative residual " << residual << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::unique_ptr<LinearSolver> clone() const override { return std::make_unique<IterativeSolver>(options); }
+
+    const IterativeOptions &getOptions() const { return options; }
+
+private:
+    bool prepare(const Eigen::SparseMatrix<double> &A)
+    {
+        if (options.preconditioner == IterativeOptions::Preconditioner::ILU)
+        {
+            ilu.setDroptol(options.dropTolerance);
+            ilu.setFillfactor(options.fillFactor);
+            ilu.compute(A);
+            if (ilu.info() != Eigen::Success)
+            {
+                std::cerr << "Error: incomplete LU factorization failed" << std::endl;
+                return false;
+            }
+        }
+        else
+        {
+            inverseDiagonal = A.diagonal();
+            for (int i = 0; i < inverseDiagonal.size(); ++i)
+                inverseDiagonal[i] = inverseDiagonal[i] != 0.0 ? 1.0 / inverseDiagonal[i] : 1.0;
+        }
+        return true;
+    }
+
+    // out = M^-1 in
+    void precondition(const Eigen::VectorXd &in, Eigen::VectorXd &out) const
+    {
+        if (options.preconditioner == IterativeOptions::Preconditioner::ILU)
+            out = ilu.solve(in);
+        else
+            out = inverseDiagonal.cwiseProduct(in);
+    }
+
+    // Right preconditioned BiCGSTAB (van der Vorst), returns the final relative residual.
+    // The shadow residual starts as r; when it becomes orthogonal to A M^-1 p, which the
+    // zero diagonal of the source rows easily causes, it is shifted off r and the
+    // recurrence restarts from the current x.
+    double bicgstab(const Eigen::SparseMatrix<double> &A, const Eigen::VectorXd &b, Eigen::VectorXd &x, double bNorm)
+    {
+        r = b - A * x;
+        rHat = r;
+        p.setZero(b.size());
+        v.setZero(b.size());
+        double rho = 1.0, alpha = 1.0, omega = 1.0;
+        double residual = r.norm() / bNorm;
+        for (int k = 0; k < options.maxIterations && residual > options.tolerance; ++k)
+        {
+            double rhoNext = rHat.dot(r);
+            p = r + (rhoNext / rho * alpha / omega) * (p - omega * v);
+            precondition(p, y);
+            v = A * y;
+            double rv = rHat.dot(v);
+            if (std::abs(rv) <= 1e-14 * rHat.norm() * v.norm() || std::abs(rhoNext) <= 1e-30 * rHat.norm() * r.norm())
+            {
+                // Breakdown, restart with a shadow residual that is not r
+                rHat = r + (r.norm() / std::sqrt(double(r.size()))) * Eigen::VectorXd::Ones(r.size());
+                p.setZero();
+                v.setZero();
+                rho = alpha = omega = 1.0;
+                iterations++;
+                continue;
+            }
+            rho = rhoNext;
+            alpha = rho / rv;
+            s = r - alpha * v;
+            x += alpha * y;
+            iterations++;
+            residual = s.norm() / bNorm;
+            if (residual <= options.tolerance)
+                break;
+            precondition(s, z);
+            t = A * z;
+            double tt = t.squaredNorm();
+            omega = tt > 0.0 ? t.dot(s) / tt : 0.0;
+            x += omega * z;
+            r = s - omega * t;
+            residual = r.norm() / bNorm;
+            if (omega == 0.0)
+            {
+                // Stagnation, restart from the current residual
+                rHat = r;
+                p.setZero();
+                v.setZero();
+                rho = alpha = omega = 1.0;
+            }
+        }
+        return (b - A * x).norm() / bNorm;
+    }
+
+    // Restarted GMRES(m) with right preconditioning and Givens rotations
+    double gmres(const Eigen::SparseMatrix<double> &A, const Eigen::VectorXd &b, Eigen::VectorXd &x, double bNorm)
+    {
+        int n = b.size(), m = std::max(1, std::min(options.restart, n));
+        basis.resize(n, m + 1);
+        hessenberg.setZero(m + 1, m);
+        g.resize(m + 1);
+        cs.resize(m);
+        sn.resize(m);
+
+        r = b - A * x;
+        double beta = r.norm();
+        int used = 0;
+        while (beta / bNorm > options.tolerance && used < options.maxIterations)
+        {
+            basis.col(0) = r / beta;
+            g.setZero();
+            g[0] = beta;
+            int j = 0;
+            for (; j < m && used < options.maxIterations; ++j, ++used)
+            {
+                // Arnoldi with modified Gram-Schmidt
+                precondition(basis.col(j), y);
+                w = A * y;
+                for (int i = 0; i <= j; ++i)
+                {
+                    hessenberg(i, j) = basis.col(i).dot(w);
+                    w -= hessenberg(i, j) * basis.col(i);
+                }
+                hessenberg(j + 1, j) = w.norm();
+                if (hessenberg(j + 1, j) != 0.0)
+                    basis.col(j + 1) = w / hessenberg(j + 1, j);
+
+                // Reduce the new column to triangular form
+                for (int i = 0; i < j; ++i)
+                {
+                    double h0 = hessenberg(i, j), h1 = hessenberg(i + 1, j);
+                    hessenberg(i, j) = cs[i] * h0 + sn[i] * h1;
+                    hessenberg(i + 1, j) = -sn[i] * h0 + cs[i] * h1;
+                }
+                double h0 = hessenberg(j, j), h1 = hessenberg(j + 1, j);
+                double norm = std::hypot(h0, h1);
+                cs[j] = norm != 0.0 ? h0 / norm : 1.0;
+                sn[j] = norm != 0.0 ? h1 / norm : 0.0;
+                hessenberg(j, j) = norm;
+                hessenberg(j + 1, j) = 0.0;
+                g[j + 1] = -sn[j] * g[j];
+                g[j] = cs[j] * g[j];
+                iterations++;
+                if (std::abs(g[j + 1]) / bNorm <= options.tolerance || h1 == 0.0)
+                {
+                    ++j;
+                    ++used;
+                    break;
+                }
+            }
+
+            // x += M^-1 V y with H y = g
+            Eigen::VectorXd coeffs = hessenberg.topLeftCorner(j, j).triangularView<Eigen::Upper>().solve(g.head(j));
+            w = basis.leftCols(j) * coeffs;
+            precondition(w, y);
+            x += y;
+            r = b - A * x;
+            beta = r.norm();
+            if (j == 0)
+                break;
+        }
+        return beta / bNorm;
+    }
+
+    IterativeOptions options;
+    Eigen::SparseMatrix<double> copy; // A of the last factor()
+    Eigen::IncompleteLUT<double> ilu;
+    Eigen::VectorXd inverseDiagonal;
+
+    // Work vectors, kept between solves
+    Eigen::VectorXd r, rHat, p, v, s, t, y, z, w, g, cs, sn;
+    Eigen::MatrixXd basis, hessenberg;
+};
+
+// Block diagonal A: the unknowns fall into groups that no matrix entry couples, such as
+// sub-circuits that only share ground. Every block is extracted and factorized on its own
+// by a clone of the circuit's solver, which costs sum(n_i^3) instead of n^3 for dense LU
+// and keeps the fill of one block out of the others. Blocks of up to MaxDenseBlock
+// unknowns are stored dense whatever the storage of A.
+class BlockSolver : public LinearSolver
+{
+public:
+    static constexpr int MaxDenseBlock = 64;
+
+    // blockOf[i]: block of unknown i, numbered from 0 to numBlocks - 1
+    BlockSolver(const std::vector<int> &blockOf, int numBlocks, const LinearSolver &prototype)
+        : blockOf(blockOf), local(blockOf.size()), blocks(numBlocks), prototype(prototype.clone()), mappedPattern(-1)
+    {
+        for (int i = 0; i < (int)blockOf.size(); ++i)
+        {
+            Block &block = blocks[blockOf[i]];
+            local[i] = block.unknowns.size();
+            block.unknowns.push_back(i);
+        }
+        for (Block &block : blocks)
+        {
+            int n = block.unknowns.size();
+            block.solver = prototype.clone();
+            block.dense = n <= MaxDenseBlock;
+            block.b.resize(n);
+            block.x.setZero(n);
+        }
+    }
+
+    int numBlocks() const { return blocks.size(); }
+
+    bool factor(const Eigen::MatrixXd &A) override
+    {
+        for (Block &block : blocks)
+        {
+            int n = block.unknowns.size();
+            block.denseA.resize(n, n);
+            for (int j = 0; j < n; ++j)
+                for (int i = 0; i < n; ++i)
+                    block.denseA(i, j) = A(block.unknowns[i], block.unknowns[j]);
+            if (!factorBlock(block, -1))
+                return false;
+        }
+        return true;
+    }
+
+    bool factor(const Eigen::SparseMatrix<double> &A, int patternVersion) override
+    {
+        if (mappedPattern != patternVersion)
+            mapPattern(A, patternVersion);
+        const double *values = A.valuePtr();
+        for (size_t k = 0; k < targets.size(); ++k)
+            *targets[k] = values[k];
+        for (Block &block : blocks)
+        {
+            if (!factorBlock(block, patternVersion))
+                return false;
+        }
+        return true;
+    }
+
+    bool solve(const Eigen::VectorXd &b, Eigen::VectorXd &x) override
+    {
+        if (x.size() != b.size())
+            x = Eigen::VectorXd::Zero(b.size());
+        bool ok = true;
+        for (Block &block : blocks)
+        {
+            for (size_t i = 0; i < block.unknowns.size(); ++i)
+            {
+                block.b[i] = b[block.unknowns[i]];
+                block.x[i] = x[block.unknowns[i]]; // initial guess of an iterative solver
+            }
+            long before = block.solver->getIterations();
+            ok = block.solver->solve(block.b, block.x) && ok;
+            iterations += block.solver->getIterations() - before;
+            for (size_t i = 0; i < block.unknowns.size(); ++i)
+                x[block.unknowns[i]] = block.x[i];
+        }
+        return ok;
+    }
+
+    std::unique_ptr<LinearSolver> clone() const override
+    {
+        return std::make_unique<BlockSolver>(blockOf, blocks.size(), *prototype);
+    }
+
+private:
+    struct Block
+    {
+        std::vector<int> unknowns; // global indices, ascending
+        std::unique_ptr<LinearSolver> solver;
+        bool dense;
+        Eigen::MatrixXd denseA;
+        Eigen::SparseMatrix<double> sparseA;
+        Eigen::VectorXd b, x;
+    };
+
+    bool factorBlock(Block &block, int patternVersion)
+    {
+        long before = block.solver->getAnalyses();
+        bool ok = block.dense || patternVersion < 0 ? block.solver->factor(block.denseA)
+                                                    : block.solver->factor(block.sparseA, patternVersion);
+        analyses += block.solver->getAnalyses() - before;
+        return ok;
+    }
+
+    // Build the storage of every block from the pattern of A and point every stored
+    // entry of A at its place in its block, so refactorizations only copy values
+    void mapPattern(const Eigen::SparseMatrix<double> &A, int patternVersion)
+    {
+        std::vector<std::vector<Eigen::Triplet<double>>> entries(blocks.size());
+        for (int col = 0; col < A.outerSize(); ++col)
+        {
+            for (Eigen::SparseMatrix<double>::InnerIterator it(A, col); it; ++it)
+            {
+                int b = blockOf[col];
+                if (blockOf[it.row()] == b && !blocks[b].dense)
+                    entries[b].emplace_back(local[it.row()], local[col], 1.0);
+            }
+        }
+        for (size_t b = 0; b < blocks.size(); ++b)
+        {
+            Block &block = blocks[b];
+            int n = block.unknowns.size();
+            if (block.dense)
+            {
+                block.denseA.setZero(n, n);
+                continue;
+            }
+            block.sparseA.resize(n, n);
+            block.sparseA.setFromTriplets(entries[b].begin(), entries[b].end());
+            block.sparseA.makeCompressed();
+        }
+
+        // Entries coupling two blocks do not exist by construction, a stray one is dropped
+        targets.clear();
+        targets.reserve(A.nonZeros());
+        for (int col = 0; col < A.outerSize(); ++col)
+        {
+            for (Eigen::SparseMatrix<double>::InnerIterator it(A, col); it; ++it)
+            {
+                Block &block = blocks[blockOf[col]];
+                if (blockOf[it.row()] != blockOf[col])
+                    targets.push_back(&discard);
+                else if (block.dense)
+                    targets.push_back(&block.denseA(local[it.row()], local[col]));
+                else
+                    targets.push_back(&block.sparseA.coeffRef(local[it.row()], local[col]));
+            }
+        }
+        mappedPattern = patternVersion;
+    }
+
+    std::vector<int> blockOf;
+    std::vector<int> local; // index of every unknown within its block
+    std::vector<Block> blocks;
+    std::unique_ptr<LinearSolver> prototype;
+    std::vector<double *> targets; // destination of every stored entry of the sparse A
+    double discard = 0.0;
+    int mappedPattern;
+};
+
+#endif // LINEAR_SOLVER_H
@@ -0,0 +1,404 @@
+#ifndef MEASURE_H
+#define MEASURE_H
+
+#include "circulator_simulator.h"
+#include <limits>
+
+// measure.h
+// .measure-style scalars of a transient, updated at every time point as the solution
+// streams through a result sink, and decimation of the stored output. Neither keeps the
+// trajectory, so a long run ends with a few numbers and a small file:
+//
+//   WaveformRecorder recorder("jj.txt", {Probe::nodeVoltage(2)});
+//   DecimatingSink envelope(Decimation::envelope(1000), &recorder); // min/max of every 1000 steps
+//   MeasurementSink measure(&envelope);
+//   measure.add(Measurement::max("vmax", Probe::nodeVoltage(2)));
+//   measure.add(Measurement::phaseSlips("slips", Probe::junctionPhase(3)));
+//   measure.add(Measurement::cross("tswitch", Probe::nodeVoltage(2), 1e-4));
+//   circuit.setResultSink(&measure);
+//   circuit.runTransient_jj(endTime, timeStep);
+//   measure.print(std::cout);
+//
+// Time weighted quantities (average, RMS, integral) use the trapezoidal rule between
+// consecutive time points inside the window [from, to].
+
+class Measurement
+{
+public:
+    enum class Kind { Max, Min, PeakToPeak, Average, RMS, Integral, Cross, Settle, PhaseSlips };
+    enum class Edge { Rise, Fall, Either };
+    static constexpr double forever = std::numeric_limits<double>::infinity();
+
+    static Measurement max(const std::string &name, Probe probe, double from = 0.0, double to = forever)
+    {
+        return Measurement(Kind::Max, name, probe, from, to);
+    }
+    static Measurement min(const std::string &name, Probe probe, double from = 0.0, double to = forever)
+    {
+        return Measurement(Kind::Min, name, probe, from, to);
+    }
+    static Measurement peakToPeak(const std::string &name, Probe probe, double from = 0.0, double to = forever)
+    {
+        return Measurement(Kind::PeakToPeak, name, probe, from, to);
+    }
+    static Measurement average(const std::string &name, Probe probe, double from = 0.0, double to = forever)
+    {
+        return Measurement(Kind::Average, name, probe, from, to);
+    }
+    static Measurement rms(const std::string &name, Probe probe, double from = 0.0, double to = forever)
+    {
+        return Measurement(Kind::RMS, name, probe, from, to);
+    }
+    static Measurement integral(const std::string &name, Probe probe, double from = 0.0, double to = forever)
+    {
+        return Measurement(Kind::Integral, name, probe, from, to);
+    }
+    // Time of the occurrence-th crossing of level, linearly interpolated, e.g. a switching time
+    static Measurement cross(const std::string &name, Probe probe, double level, Edge edge = Edge::Rise,
+                             int occurrence = 1, double from = 0.0, double to = forever)
+    {
+        Measurement m(Kind::Cross, name, probe, from, to);
+        m.level = level;
+        m.edge = edge;
+        m.occurrence = occurrence;
+        return m;
+    }
+    // Time after which the signal stays within target +- band
+    static Measurement settle(const std::string &name, Probe probe, double target, double band,
+                              double from = 0.0, double to = forever)
+    {
+        Measurement m(Kind::Settle, name, probe, from, to);
+        m.level = target;
+        m.band = band;
+        return m;
+    }
+    // Net number of 2 pi slips of a junction phase, negative for slips backwards
+    static Measurement phaseSlips(const std::string &name, Probe phase, double from = 0.0, double to = forever)
+    {
+        return Measurement(Kind::PhaseSlips, name, phase, from, to);
+    }
+
+    const std::string &getName() const { return name; }
+    Kind getKind() const { return kind; }
+    const Probe &getProbe() const { return probe; }
+    // The measured value, for Cross and Settle a time. NaN when it was not found
+    // (no point in the window, fewer crossings, not settled at the end).
+    double value() const
+    {
+        if (samples == 0)
+            return NAN;
+        double duration = last - first;
+        switch (kind)
+        {
+        case Kind::Max: return high;
+        case Kind::Min: return low;
+        case Kind::PeakToPeak: return high - low;
+        case Kind::Average: return duration > 0.0 ? sum / duration : previous;
+        case Kind::RMS: return duration > 0.0 ? std::sqrt(sumSquares / duration) : std::abs(previous);
+        case Kind::Integral: return sum;
+        case Kind::Cross: return found;
+        case Kind::Settle: return std::abs(previous - level) <= band ? found : NAN;
+        default: return slips;
+        }
+    }
+    // Time of the maximum or minimum, the last time point in the window otherwise
+    double time() const
+    {
+        if (kind == Kind::Max)
+            return highTime;
+        if (kind == Kind::Min)
+            return lowTime;
+        return samples > 0 ? last : NAN;
+    }
+
+private:
+    friend class MeasurementSink;
+
+    Measurement(Kind kind, const std::string &name, Probe probe, double from, double to)
+        : kind(kind), name(name), probe(probe), from(from), to(to), level(0.0), band(0.0), edge(Edge::Rise),
+          occurrence(1), index(-1)
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        samples = 0;
+        first = last = previous = 0.0;
+        high = -forever;
+        low = forever;
+        highTime = lowTime = NAN;
+        sum = sumSquares = 0.0;
+        crossings = 0;
+        found = NAN;
+        reference = 0.0;
+        slips = 0;
+    }
+
+    void add(double t, double v)
+    {
+        if (t < from || t > to)
+            return;
+        if (samples == 0)
+        {
+            first = t;
+            reference = v;
+            if (kind == Kind::Settle)
+                found = std::abs(v - level) <= band ? t : NAN;
+        }
+        else
+        {
+            double dt = t - last;
+            sum += 0.5 * dt * (v + previous);
+            sumSquares += 0.5 * dt * (v * v + previous * previous);
+            if (kind == Kind::Cross && crossings < occurrence)
+            {
+                bool rise = previous < level && v >= level;
+                bool fall = previous > level && v <= level;
+                if ((rise && edge != Edge::Fall) || (fall && edge != Edge::Rise))
+                {
+                    if (++crossings == occurrence)
+                        found = last + dt * (level - previous) / (v - previous);
+                }
+            }
+            if (kind == Kind::Settle)
+            {
+                // Entering the band is the settling time until the signal leaves it again
+                double before = std::abs(previous - level) - band, now = std::abs(v - level) - band;
+                if (before > 0.0 && now <= 0.0)
+                    found = last + dt * before / (before - now);
+                else if (now > 0.0)
+                    found = NAN;
+            }
+        }
+        if (kind == Kind::PhaseSlips)
+        {
+            while (v - reference >= 2 * M_PI)
+            {
+                reference += 2 * M_PI;
+                slips++;
+            }
+            while (v - reference <= -2 * M_PI)
+            {
+                reference -= 2 * M_PI;
+                slips--;
+            }
+        }
+        if (v > high)
+        {
+            high = v;
+            highTime = t;
+        }
+        if (v < low)
+        {
+            low = v;
+            lowTime = t;
+        }
+        previous = v;
+        last = t;
+        samples++;
+    }
+
+    Kind kind;
+    std::string name;
+    Probe probe;
+    double from, to;
+    double level, band; // Cross level, Settle target and band
+    Edge edge;
+    int occurrence;
+    int index; // into the solution vector, resolved in begin
+
+    // Running state
+    long samples;
+    double first, last, previous;
+    double high, low, highTime, lowTime;
+    double sum, sumSquares; // trapezoidal integrals of v and v^2
+    int crossings;
+    double found;
+    double reference; // phase of the last counted slip
+    long slips;
+};
+
+// Updates its measurements at every time point and passes the point on to the next sink
+class MeasurementSink : public ResultSink
+{
+public:
+    explicit MeasurementSink(ResultSink *next = nullptr) : next(next) {}
+
+    size_t add(const Measurement &measurement)
+    {
+        measurements.push_back(measurement);
+        return measurements.size() - 1;
+    }
+    const std::vector<Measurement> &getMeasurements() const { return measurements; }
+    const Measurement &operator[](size_t i) const { return measurements[i]; }
+    // First measurement of that name, nullptr if there is none
+    const Measurement *find(const std::string &name) const
+    {
+        for (const auto &measurement : measurements)
+        {
+            if (measurement.getName() == name)
+                return &measurement;
+        }
+        return nullptr;
+    }
+
+    void begin(int numNodes, int numVoltageSources) override
+    {
+        for (auto &measurement : measurements)
+        {
+            measurement.reset();
+            measurement.index = measurement.probe.index(numNodes);
+        }
+        if (next)
+            next->begin(numNodes, numVoltageSources);
+    }
+
+    void record(double t, const Eigen::VectorXd &x) override
+    {
+        for (auto &measurement : measurements)
+            measurement.add(t, measurement.index >= 0 && measurement.index < x.size() ? x[measurement.index] : 0.0);
+        if (next)
+            next->record(t, x);
+    }
+
+    void end() override
+    {
+        if (next)
+            next->end();
+    }
+
+    // name = value lines, with the time of the extremum for Max and Min
+    void print(std::ostream &out) const
+    {
+        for (const auto &measurement : measurements)
+        {
+            out << measurement.getName() << " = " << measurement.value();
+            if (measurement.getKind() == Measurement::Kind::Max || measurement.getKind() == Measurement::Kind::Min)
+                out << " at " << measurement.time();
+            out << "\n";
+        }
+    }
+
+    void saveToFile(const std::string &filename) const
+    {
+        std::ofstream file(filename);
+        if (!file.is_open())
+        {
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return;
+        }
+        print(file);
+    }
+
+private:
+    std::vector<Measurement> measurements;
+    ResultSink *next;
+};
+
+// Which time points DecimatingSink passes on
+struct Decimation
+{
+    enum class Mode { EveryNth, Envelope };
+    Mode mode;
+    size_t factor;
+
+    // Every factor-th point, starting with the first
+    static Decimation everyNth(size_t factor) { return {Mode::EveryNth, std::max<size_t>(factor, 1)}; }
+    // Per window of factor points two points: the element-wise minimum at the window start
+    // and the maximum at its end, so peaks and glitches survive in the plotted envelope
+    static Decimation envelope(size_t factor) { return {Mode::Envelope, std::max<size_t>(factor, 1)}; }
+};
+
+// Forwards a decimated stream to the next sink, e.g. a WaveformRecorder, or keeps it in
+// memory in the layout of Circuit::getResults when there is none
+class DecimatingSink : public ResultSink
+{
+public:
+    explicit DecimatingSink(Decimation decimation, ResultSink *next = nullptr)
+        : decimation(decimation), next(next), count(0), windowStart(0.0), windowEnd(0.0) {}
+
+    const std::vector<std::pair<double, std::vector<double>>> &getResults() const { return results; }
+
+    void begin(int numNodes, int numVoltageSources) override
+    {
+        results.clear();
+        count = 0;
+        if (next)
+            next->begin(numNodes, numVoltageSources);
+    }
+
+    void record(double t, const Eigen::VectorXd &x) override
+    {
+        if (decimation.mode == Decimation::Mode::EveryNth)
+        {
+            if (count++ % decimation.factor == 0)
+                emit(t, x);
+            return;
+        }
+        if (count++ % decimation.factor == 0)
+        {
+            low = x;
+            high = x;
+            windowStart = t;
+        }
+        else
+        {
+            low = low.cwiseMin(x);
+            high = high.cwiseMax(x);
+        }
+        windowEnd = t;
+        if (count % decimation.factor == 0)
+            flush();
+    }
+
+    void end() override
+    {
+        if (decimation.mode == Decimation::Mode::Envelope && count % decimation.factor != 0)
+            flush(); // partial last window
+        if (next)
+            next->end();
+    }
+
+    void saveToFile(const std::string &filename) const
+    {
+        std::ofstream file(filename);
+        if (!file.is_open())
+        {
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return;
+        }
+        for (const auto &[time, x] : results)
+        {
+            file << time;
+            for (double value : x)
+                file << ", " << value;
+            file << "\n";
+        }
+    }
+
+private:
+    void flush()
+    {
+        emit(windowStart, low);
+        if (windowEnd > windowStart)
+            emit(windowEnd, high);
+    }
+
+    void emit(double t, const Eigen::VectorXd &x)
+    {
+        if (next)
+            next->record(t, x);
+        else
+            results.emplace_back(t, std::vector<double>(x.data(), x.data() + x.size()));
+    }
+
+    Decimation decimation;
+    ResultSink *next;
+    size_t count;
+    Eigen::VectorXd low, high; // envelope of the current window
+    double windowStart, windowEnd;
+    std::vector<std::pair<double, std::vector<double>>> results;
+};
+
+#endif // MEASURE_H
@@ -0,0 +1,465 @@
+#ifndef MODEL_REDUCTION_H
+#define MODEL_REDUCTION_H
+
+#include "circulator_simulator.h"
+#include <numeric>
+#include <unordered_map>
+
+// model_reduction.h
+// Krylov model-order reduction of the passive parts of a circuit. The resistors, capacitors
+// and inductors form sub-networks between the nodes that other components (junctions,
+// sources) or the user need, the ports. Each large sub-network is replaced by a
+// ReducedNetwork whose size depends on the number of ports and matched moments, not on its
+// internal nodes:
+//
+//   ModelReduction reduction(circuit);
+//   ReductionOptions options;
+//   options.keepNodes = {42};            // probed nodes stay in the circuit
+//   if (reduction.run(options)) {
+//       Circuit &reduced = reduction.getCircuit();
+//       reduced.runTransient_jj(endTime, timeStep);
+//       int out = reduction.node(42);    // node numbers are compacted
+//   }
+//
+// A sub-network is written as G x + C dx/dt = port currents with x its port voltages,
+// internal node voltages and inductor currents. With the internal part approximated in
+// the block Krylov space of (G_uu + s0 C_uu)^-1 C_uu at the expansion points s0 (PRIMA),
+// x = [I 0; 0 V] [v_ports; z], the congruence X^T G X, X^T C X keeps the port rows and
+// the passivity of the original network, and matches `moments` block moments of the port
+// admittance at every expansion point.
+
+// Dense linear multi-port G y + C dy/dt = current leaving into the network, on the port
+// nodes followed by the nodes of its reduced states y. Stamped through the companion model
+// of the integration method like a capacitor, one dense block per step.
+class ReducedNetwork : public Component
+{
+public:
+    ReducedNetwork(std::vector<int> nodes, size_t ports, Eigen::MatrixXd g, Eigen::MatrixXd c, double dt)
+        : nodes(std::move(nodes)), g(std::move(g)), c(std::move(c)), timeStep(dt), ports(ports)
+    {
+        node1 = this->nodes.empty() ? 0 : this->nodes.front();
+        node2 = 0;
+        value = 0.0;
+        int k = this->nodes.size();
+        prev = prev2 = rate = current = Eigen::VectorXd::Zero(k);
+        for (int j = 0; j < k; ++j)
+        {
+            for (int i = 0; i < k; ++i)
+            {
+                if (this->g(i, j) != 0.0 || this->c(i, j) != 0.0)
+                    entries.emplace_back(i, j);
+            }
+        }
+    }
+
+    // Every entry that is non-zero in G or C, so the sparse pattern is the same at DC
+    void stampMatrix(MNASystem &sys) const override
+    {
+        double a0 = sys.isOperatingPoint() ? 0.0 : sys.coefficients(timeStep).a0; // C open at DC
+        for (const auto &[i, j] : entries)
+            sys.addA(nodes[i] - 1, nodes[j] - 1, g(i, j) + a0 * c(i, j));
+    }
+
+    void stampRHS(MNASystem &sys) const override
+    {
+        if (sys.isOperatingPoint())
+            return;
+        IntegrationCoeffs k = sys.coefficients(timeStep);
+        for (size_t i = 0; i < nodes.size(); ++i)
+            sys.addZ(nodes[i] - 1, -historyCurrent(k, i));
+    }
+
+    void acceptStep(const MNASystem &sys) override
+    {
+        const Eigen::VectorXd &x = sys.solution();
+        IntegrationCoeffs k = sys.coefficients(timeStep);
+        for (size_t i = 0; i < nodes.size(); ++i)
+            current[i] = x[nodes[i] - 1];
+        rate = k.b1 * rate + c * (k.a0 * current + k.a1 * prev + k.a2 * prev2); // C dy/dt
+        prev2 = prev;
+        prev = current;
+    }
+
+    void stampAC(ACStamp &ac, const Eigen::VectorXd &) const override
+    {
+        for (const auto &[i, j] : entries)
+        {
+            ac.g.emplace_back(nodes[i] - 1, nodes[j] - 1, g(i, j));
+            ac.c.emplace_back(nodes[i] - 1, nodes[j] - 1, c(i, j));
+        }
+    }
+
+    void appendUnknowns(int, std::vector<int> &unknowns) const override
+    {
+        for (int node : nodes)
+            unknowns.push_back(node - 1);
+    }
+    int highestNode() const override { return nodes.empty() ? 0 : *std::max_element(nodes.begin(), nodes.end()); }
+    void renumberNodes(const std::vector<int> &map) override
+    {
+        for (int &node : nodes)
+            node = map[node];
+        node1 = nodes.empty() ? 0 : nodes.front();
+    }
+
+    std::unique_ptr<Component> clone() const override { return std::make_unique<ReducedNetwork>(*this); }
+    Component *cloneInto(ComponentArena &arena) const override { return arena.create<ReducedNetwork>(*this); }
+
+    void saveState(std::vector<double> &state) const override
+    {
+        state.push_back(value);
+        for (const auto *v : {&prev, &prev2, &rate})
+            state.insert(state.end(), v->data(), v->data() + v->size());
+    }
+    const double *restoreState(const double *state) override
+    {
+        value = *state++;
+        for (auto *v : {&prev, &prev2, &rate})
+        {
+            std::copy(state, state + v->size(), v->data());
+            state += v->size();
+        }
+        return state;
+    }
+    void appendStateKinds(std::vector<StateKind> &kinds) const override
+    {
+        kinds.push_back(StateKind::Parameter);
+        kinds.insert(kinds.end(), 2 * nodes.size(), StateKind::Voltage);
+        kinds.insert(kinds.end(), nodes.size(), StateKind::Current);
+    }
+
+    size_t getNumPorts() const { return ports; }
+    size_t getNumStates() const { return nodes.size() - ports; }
+    const std::vector<int> &getNodes() const { return nodes; }
+
+private:
+    friend class ModelReduction;
+
+    // Current of row i into the network that does not depend on y(n)
+    double historyCurrent(const IntegrationCoeffs &k, size_t i) const
+    {
+        double h = k.b1 * rate[i];
+        for (Eigen::Index j = 0; j < c.cols(); ++j)
+            h += c(i, j) * (k.a1 * prev[j] + k.a2 * prev2[j]);
+        return h;
+    }
+
+    std::vector<int> nodes;                 // ports, then the reduced states
+    Eigen::MatrixXd g, c;
+    std::vector<std::pair<int, int>> entries; // structural non-zeros of G and C
+    double timeStep;                        // Default time step, used when the analysis does not provide one
+    size_t ports;
+    Eigen::VectorXd prev, prev2, rate;      // y one and two steps ago, C dy/dt of the last step
+    Eigen::VectorXd current;                // y of the accepted step
+};
+
+struct ReductionOptions
+{
+    std::vector<double> frequencies = {0.0}; // expansion points [Hz], 0 matches the moments at DC
+    int moments = 4;                 // block moments per expansion point
+    size_t minNodes = 20;            // smaller sub-networks are kept as they are
+    std::vector<int> keepNodes;      // nodes that stay in the circuit, e.g. probed ones
+    double deflationTol = 1e-10;     // Krylov vectors below this relative norm are dropped
+};
+
+class ModelReduction
+{
+public:
+    ModelReduction(const Circuit &prototype) : prototype(prototype), eliminated(0), states(0) {}
+
+    // Builds the reduced copy of the prototype, which is left unchanged. The remaining
+    // components keep their order and are followed by one ReducedNetwork per reduced
+    // sub-network. The copy starts from rest, reduce before running the circuit.
+    // Returns false if an expansion point makes a sub-network singular.
+    bool run(const ReductionOptions &options = ReductionOptions())
+    {
+        reduced.reset();
+        networks.clear();
+        eliminated = 0;
+        states = 0;
+        int numNodes = prototype.getNumNodes();
+        if (prototype.getTime() > 0.0)
+            std::cerr << "Warning: the reduced networks start from rest, not from the state at t = " << prototype.getTime() << std::endl;
+
+        // Ports: nodes of the other components and the kept ones
+        std::vector<char> port(numNodes + 1, 0), touched(numNodes + 1, 0);
+        std::vector<int> unknowns;
+        for (size_t i = 0; i < prototype.getNumComponents(); ++i)
+        {
+            const Component *component = prototype.getComponent(i);
+            if (passive(component))
+            {
+                touched[component->getNode1()] = touched[component->getNode2()] = 1;
+                continue;
+            }
+            unknowns.clear();
+            component->appendUnknowns(numNodes, unknowns);
+            for (int u : unknowns)
+            {
+                if (u < numNodes)
+                    port[u + 1] = 1;
+            }
+        }
+        for (int node : options.keepNodes)
+        {
+            if (node > 0 && node <= numNodes)
+                port[node] = 1;
+        }
+        auto internal = [&](int node) { return node > 0 && touched[node] && !port[node]; };
+
+        // Sub-networks: internal nodes joined by passive components (union-find)
+        std::vector<int> parent(numNodes + 1);
+        std::iota(parent.begin(), parent.end(), 0);
+        auto find = [&parent](int node) {
+            while (parent[node] != node)
+                node = parent[node] = parent[parent[node]];
+            return node;
+        };
+        for (size_t i = 0; i < prototype.getNumComponents(); ++i)
+        {
+            const Component *component = prototype.getComponent(i);
+            if (passive(component) && internal(component->getNode1()) && internal(component->getNode2()))
+                parent[find(component->getNode1())] = find(component->getNode2());
+        }
+        std::vector<int> group(numNodes + 1, -1), owner(prototype.getNumComponents(), -1);
+        std::vector<SubNetwork> groups;
+        for (int node = 1; node <= numNodes; ++node)
+        {
+            if (!internal(node))
+                continue;
+            int root = find(node);
+            if (group[root] < 0)
+            {
+                group[root] = groups.size();
+                groups.emplace_back();
+            }
+            group[node] = group[root];
+            groups[group[node]].internal.push_back(node);
+        }
+        for (size_t i = 0; i < prototype.getNumComponents(); ++i)
+        {
+            const Component *component = prototype.getComponent(i);
+            if (!passive(component))
+                continue;
+            int n1 = component->getNode1(), n2 = component->getNode2();
+            int k = internal(n1) ? group[n1] : internal(n2) ? group[n2] : -1;
+            if (k < 0)
+                continue; // between ports, stays
+            owner[i] = k;
+            groups[k].components.push_back(component);
+            for (int node : {n1, n2})
+            {
+                if (node > 0 && port[node])
+                    groups[k].ports.push_back(node);
+            }
+        }
+
+        // Reduce the large ones, the others keep their components
+        for (auto &network : groups)
+        {
+            std::sort(network.ports.begin(), network.ports.end());
+            network.ports.erase(std::unique(network.ports.begin(), network.ports.end()), network.ports.end());
+            if (network.internal.size() < options.minNodes || network.ports.empty())
+                continue;
+            if (!reduce(network, options))
+                return false;
+        }
+
+        // Number the remaining nodes in order, then the states of every reduced network
+        nodeMap.assign(numNodes + 1, 0);
+        int next = 0;
+        for (int node = 1; node <= numNodes; ++node)
+        {
+            bool gone = group[node] >= 0 && groups[group[node]].model != nullptr;
+            nodeMap[node] = gone ? -1 : ++next;
+            eliminated += gone;
+        }
+        reduced = std::make_unique<Circuit>();
+        reduced->setMatrixMode(prototype.getMatrixMode());
+        reduced->setLinearSolver(prototype.getLinearSolver().clone());
+        reduced->setNROptions(prototype.getNROptions());
+        reduced->setIntegrationMethod(prototype.getIntegrationMethod());
+        for (size_t i = 0; i < prototype.getNumComponents(); ++i)
+        {
+            if (owner[i] >= 0 && groups[owner[i]].model)
+                continue;
+            std::unique_ptr<Component> copy = prototype.getComponent(i)->clone();
+            copy->renumberNodes(nodeMap);
+            reduced->addComponent(std::move(copy));
+        }
+        for (auto &network : groups)
+        {
+            if (!network.model)
+                continue;
+            std::vector<int> &nodes = network.model->nodes;
+            size_t ports = network.ports.size();
+            for (size_t p = 0; p < ports; ++p)
+                nodes[p] = nodeMap[nodes[p]];
+            for (size_t s = ports; s < nodes.size(); ++s)
+                nodes[s] = ++next;
+            network.model->node1 = nodes.front();
+            states += network.model->getNumStates();
+            networks.push_back(network.model.get());
+            reduced->addComponent(std::move(network.model));
+        }
+        return true;
+    }
+
+    Circuit &getCircuit() { return *reduced; } // after a successful run
+    std::unique_ptr<Circuit> release() { return std::move(reduced); }
+
+    // Node number in the reduced circuit, 0 for ground and -1 for a node reduced away
+    int node(int original) const
+    {
+        return original >= 0 && size_t(original) < nodeMap.size() ? nodeMap[original] : -1;
+    }
+    Probe probe(const Probe &original) const
+    {
+        return original.kind == Probe::Kind::SourceCurrent ? original : Probe{original.kind, node(original.id)};
+    }
+    size_t getNumNetworks() const { return networks.size(); }
+    int getEliminatedNodes() const { return eliminated; }
+    int getStates() const { return states; } // unknowns added by the reduced networks
+
+private:
+    struct SubNetwork
+    {
+        std::vector<int> internal, ports;
+        std::vector<const Component *> components;
+        std::unique_ptr<ReducedNetwork> model;
+    };
+
+    static bool passive(const Component *component)
+    {
+        return dynamic_cast<const Resistor *>(component) || dynamic_cast<const Capacitor *>(component) ||
+               dynamic_cast<const Inductor *>(component);
+    }
+
+    // PRIMA of one sub-network, network.model stays empty if it would not get smaller
+    bool reduce(SubNetwork &network, const ReductionOptions &options)
+    {
+        using SparseMatrix = Eigen::SparseMatrix<double>;
+        int m = network.ports.size(), nodes = network.internal.size();
+        std::unordered_map<int, int> local; // ports first, then the internal nodes
+        for (int p = 0; p < m; ++p)
+            local[network.ports[p]] = p;
+        for (int i = 0; i < nodes; ++i)
+            local[network.internal[i]] = m + i;
+        auto index = [&local](int node) { return node > 0 ? local.at(node) : -1; };
+
+        // G and C of the nodal equations, inductors add their current as unknown:
+        // KCL rows +-i, branch row L di/dt - (v1 - v2) = 0, so G + G^T and C are semidefinite
+        std::vector<Eigen::Triplet<double>> gt, ct;
+        auto branch = [](std::vector<Eigen::Triplet<double>> &t, int i, int j, double y) {
+            if (i >= 0)
+                t.emplace_back(i, i, y);
+            if (j >= 0)
+                t.emplace_back(j, j, y);
+            if (i >= 0 && j >= 0)
+            {
+                t.emplace_back(i, j, -y);
+                t.emplace_back(j, i, -y);
+            }
+        };
+        int n = m + nodes;
+        double dt = 0.0;
+        for (const Component *component : network.components)
+        {
+            int i = index(component->getNode1()), j = index(component->getNode2());
+            if (dynamic_cast<const Resistor *>(component))
+                branch(gt, i, j, 1.0 / component->getValue());
+            else if (auto *capacitor = dynamic_cast<const Capacitor *>(component))
+            {
+                branch(ct, i, j, component->getValue());
+                dt = capacitor->getTimeStep();
+            }
+            else
+            {
+                int l = n++;
+                for (auto [node, sign] : {std::make_pair(i, 1.0), std::make_pair(j, -1.0)})
+                {
+                    if (node < 0)
+                        continue;
+                    gt.emplace_back(node, l, sign);
+                    gt.emplace_back(l, node, -sign);
+                }
+                ct.emplace_back(l, l, component->getValue());
+                dt = static_cast<const Inductor *>(component)->getTimeStep();
+            }
+        }
+        SparseMatrix G(n, n), C(n, n);
+        G.setFromTriplets(gt.begin(), gt.end());
+        C.setFromTriplets(ct.begin(), ct.end());
+        int u = n - m;
+        SparseMatrix Guu = G.bottomRightCorner(u, u), Cuu = C.bottomRightCorner(u, u);
+        Eigen::MatrixXd Gup = G.bottomLeftCorner(u, m), Cup = C.bottomLeftCorner(u, m);
+
+        // Block Arnoldi on (G_uu + s0 C_uu)^-1 C_uu from the responses to the port voltages
+        std::vector<Eigen::VectorXd> basis;
+        for (double f : options.frequencies)
+        {
+            double s0 = 2 * M_PI * f;
+            SparseMatrix K = Guu + s0 * Cuu;
+            Eigen::SparseLU<SparseMatrix, Eigen::COLAMDOrdering<int>> lu(K);
+            if (lu.info() != Eigen::Success)
+            {
+                std::cerr << "Error: passive sub-network with " << nodes << " nodes is singular at the expansion point "
+                          << f << " Hz" << std::endl;
+                return false;
+            }
+            Eigen::MatrixXd start(u, 2 * m);
+            start << -(Gup + s0 * Cup), Cup;
+            Eigen::MatrixXd block = lu.solve(start);
+            for (int k = 0; k < options.moments && block.cols() > 0; ++k)
+            {
+                size_t first = basis.size();
+                for (Eigen::Index col = 0; col < block.cols(); ++col)
+                    orthonormalize(basis, block.col(col), options.deflationTol);
+                Eigen::MatrixXd added(u, basis.size() - first);
+                for (size_t b = first; b < basis.size(); ++b)
+                    added.col(b - first) = basis[b];
+                block = lu.solve(Cuu * added);
+            }
+        }
+        int q = basis.size();
+        if (q >= nodes)
+            return true; // no smaller than the original
+
+        // Congruence with X = [I 0; 0 V]
+        Eigen::MatrixXd X = Eigen::MatrixXd::Zero(n, m + q);
+        X.topLeftCorner(m, m).setIdentity();
+        for (int b = 0; b < q; ++b)
+            X.col(m + b).tail(u) = basis[b];
+        Eigen::MatrixXd Gr = X.transpose() * (G * X), Cr = X.transpose() * (C * X);
+
+        std::vector<int> ports = network.ports;
+        ports.resize(m + q, 0); // state nodes are numbered with the circuit
+        network.model = std::make_unique<ReducedNetwork>(std::move(ports), m, std::move(Gr), std::move(Cr), dt);
+        return true;
+    }
+
+    // Two passes of modified Gram-Schmidt, v is added unless it is (nearly) in the span
+    static void orthonormalize(std::vector<Eigen::VectorXd> &basis, Eigen::VectorXd v, double tolerance)
+    {
+        double norm = v.norm();
+        if (!(norm > 0.0))
+            return;
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (const auto &b : basis)
+                v -= b.dot(v) * b;
+        }
+        double remaining = v.norm();
+        if (remaining > tolerance * norm)
+            basis.push_back(v / remaining);
+    }
+
+    const Circuit &prototype;
+    std::unique_ptr<Circuit> reduced;
+    std::vector<int> nodeMap;
+    std::vector<const ReducedNetwork *> networks;
+    int eliminated;
+    int states;
+};
+
+#endif // MODEL_REDUCTION_H
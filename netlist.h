@@ -0,0 +1,676 @@
+#ifndef NETLIST_H
+#define NETLIST_H
+
+#include "circulator_simulator.h"
+#include <charconv>
+#include <string_view>
+#include <unordered_map>
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+
+// netlist.h
+// SPICE-style netlist reader, so a circuit can be loaded without recompiling:
+//
+//   * RC ladder                       <- first line is the title
+//   .model jj1 jj(icrit=0.1mA, rn=16, cap=0.07pF)
+//   .subckt cell in out
+//   R1 in mid 1k
+//   C1 mid 0 1p
+//   L1 mid out 1n
+//   .ends
+//   V1 1 0 DC 5
+//   X1 1 2 cell
+//   B1 2 0 jj1 area=1.5
+//   .tran 1p 1n
+//   .end
+//
+// Cards: R, L, C (value), V (optional DC keyword, then value), B (Josephson junction:
+// a .model of type jj and/or inline icrit, r/rn/r0, cap parameters, scaled by area;
+// its phase unknown gets a node of its own), X (subcircuit instance, nodes then the
+// subcircuit name), .subckt/.ends, .model, .tran step stop, .end. Lines starting with
+// '*' and text after ';' are comments, lines starting with '+' continue the card.
+// Names are case insensitive and values take SPICE scale suffixes (f p n u m k meg g t),
+// trailing units such as "pF" or "mV" are ignored.
+//
+// Nodes named by plain integers keep their numeric order (1, 2, ... when the netlist
+// numbers them that way), other names follow; "0" and "gnd" are ground. Subcircuit
+// internal nodes and junction phase nodes are appended after the top level nodes.
+//
+// The file is memory-mapped and every token is a view into it, node and subcircuit names
+// are looked up without building strings, and the components are constructed in one go
+// into reserved storage once the whole netlist is parsed.
+struct NetlistInfo
+{
+    std::string title;
+    double tranStep = 0.0; // from .tran, 0 if absent
+    double tranStop = 0.0;
+    std::vector<std::string> nodeNames; // by circuit node index, empty for ground and internal nodes
+    size_t numComponents = 0;
+
+    // Circuit node of a top level node name, -1 if there is none
+    int nodeIndex(std::string_view name) const;
+};
+
+namespace netlist_detail
+{
+inline char lower(char c) { return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c; }
+
+inline bool iequals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (lower(a[i]) != lower(b[i]))
+            return false;
+    return true;
+}
+
+// Case insensitive hashing of names, the views point into the mapped file
+struct IHash
+{
+    size_t operator()(std::string_view s) const
+    {
+        size_t h = 1469598103934665603ull; // FNV-1a
+        for (char c : s)
+            h = (h ^ size_t(lower(c))) * 1099511628211ull;
+        return h;
+    }
+};
+struct IEqual
+{
+    bool operator()(std::string_view a, std::string_view b) const { return iequals(a, b); }
+};
+template <typename T>
+using NameMap = std::unordered_map<std::string_view, T, IHash, IEqual>;
+
+// SPICE number: a decimal value followed by an optional scale suffix and unit letters
+inline bool parseValue(std::string_view token, double &value)
+{
+    const char *first = token.data(), *last = token.data() + token.size();
+    if (first != last && *first == '+')
+        ++first; // from_chars does not take a leading plus
+    auto [rest, ec] = std::from_chars(first, last, value);
+    if (ec != std::errc())
+        return false;
+
+    std::string_view suffix(rest, last - rest);
+    if (suffix.size() >= 3 && iequals(suffix.substr(0, 3), "meg"))
+        value *= 1e6;
+    else if (suffix.size() >= 3 && iequals(suffix.substr(0, 3), "mil"))
+        value *= 25.4e-6;
+    else if (!suffix.empty())
+    {
+        switch (lower(suffix[0]))
+        {
+        case 'f': value *= 1e-15; break;
+        case 'p': value *= 1e-12; break;
+        case 'n': value *= 1e-9; break;
+        case 'u': value *= 1e-6; break;
+        case 'm': value *= 1e-3; break;
+        case 'k': value *= 1e3; break;
+        case 'g': value *= 1e9; break;
+        case 't': value *= 1e12; break;
+        default: break; // unit only
+        }
+    }
+    return true;
+}
+
+inline bool isIntegerName(std::string_view name, long &number)
+{
+    if (name.empty() || name.size() > 18)
+        return false;
+    number = 0;
+    for (char c : name)
+    {
+        if (c < '0' || c > '9')
+            return false;
+        number = number * 10 + (c - '0');
+    }
+    return true;
+}
+
+// Splits the mapped text into cards, a card is one line plus its '+' continuation lines.
+// Tokens are separated by blanks, commas, parentheses and '=', so "icrit=0.1mA" gives
+// the key and the value as two tokens.
+class Lexer
+{
+public:
+    Lexer(const char *begin, const char *end) : p(begin), end(end), lineNo(0) {}
+
+    // The raw first line, SPICE treats it as the title
+    std::string_view titleLine()
+    {
+        const char *start = p;
+        while (p < end && *p != '\n')
+            ++p;
+        std::string_view title(start, p - start);
+        if (p < end)
+            ++p;
+        ++lineNo;
+        while (!title.empty() && (title.back() == '\r' || title.back() == ' '))
+            title.remove_suffix(1);
+        return title;
+    }
+
+    // Tokens of the next card, false at the end of the input. line is the first line of the card.
+    bool next(std::vector<std::string_view> &tokens, size_t &line)
+    {
+        tokens.clear();
+        while (p < end)
+        {
+            ++lineNo;
+            const char *start = p;
+            while (start < end && (*start == ' ' || *start == '\t'))
+                ++start;
+            if (start == end || *start == '\n' || *start == '\r' || *start == '*')
+            {
+                skipLine();
+                continue;
+            }
+            line = lineNo;
+            p = start;
+            tokenizeLine(tokens);
+            while (p < end && *p == '+')
+            {
+                ++lineNo;
+                ++p;
+                tokenizeLine(tokens);
+            }
+            if (!tokens.empty())
+                return true;
+        }
+        return false;
+    }
+
+private:
+    static bool isSeparator(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == ',' || c == '(' || c == ')' || c == '=';
+    }
+
+    void skipLine()
+    {
+        while (p < end && *p != '\n')
+            ++p;
+        if (p < end)
+            ++p;
+    }
+
+    void tokenizeLine(std::vector<std::string_view> &tokens)
+    {
+        while (p < end && *p != '\n')
+        {
+            if (*p == ';')
+                break; // comment to the end of the line
+            if (isSeparator(*p))
+            {
+                ++p;
+                continue;
+            }
+            const char *start = p;
+            while (p < end && *p != '\n' && *p != ';' && !isSeparator(*p))
+                ++p;
+            tokens.emplace_back(start, p - start);
+        }
+        skipLine();
+    }
+
+    const char *p;
+    const char *end;
+    size_t lineNo;
+};
+
+// Junction parameters, NaN when not given
+struct JJParams
+{
+    double icrit = NAN, r = NAN, cap = NAN, area = NAN;
+
+    void set(std::string_view key, double value)
+    {
+        if (iequals(key, "icrit") || iequals(key, "ic"))
+            icrit = value;
+        else if (iequals(key, "r"))
+            r = value;
+        else if (iequals(key, "rn") && std::isnan(r))
+            r = value;
+        else if (iequals(key, "r0") && std::isnan(r))
+            r = value;
+        else if (iequals(key, "cap") || iequals(key, "c"))
+            cap = value;
+        else if (iequals(key, "area"))
+            area = value;
+    }
+
+    // Fill what is not set from the model
+    void inherit(const JJParams &model)
+    {
+        if (std::isnan(icrit)) icrit = model.icrit;
+        if (std::isnan(r)) r = model.r;
+        if (std::isnan(cap)) cap = model.cap;
+        if (std::isnan(area)) area = model.area;
+    }
+};
+
+// Element card with subcircuit local node indices, 0 is ground
+struct Element
+{
+    char type; // 'R', 'L', 'C', 'V', 'B'
+    int n1, n2;
+    double value;
+    std::string_view model; // junction model name, may be empty
+    JJParams params;
+    size_t line;
+};
+
+struct Instance
+{
+    std::string_view subckt;
+    int firstNode; // into Subckt::instanceNodes
+    int numNodes;
+    int resolved;  // subcircuit index once resolved
+    size_t line;
+};
+
+struct Subckt
+{
+    std::string_view name;
+    int numPorts = 0;
+    NameMap<int> localNodes;               // name -> local index, from 1
+    std::vector<int> numericNodes;         // integer name -> local index, 0 if not seen yet
+    std::vector<std::string_view> nodeNames; // by local index - 1
+    std::vector<Element> elements;
+    std::vector<Instance> instances;
+    std::vector<int> instanceNodes;
+    size_t count = 0; // components after expansion, 0 until counted
+    bool counting = false;
+
+    int node(std::string_view name)
+    {
+        if (name == "0" || iequals(name, "gnd"))
+            return 0;
+
+        // Extracted netlists mostly number their nodes, those skip the hash map. The table
+        // only grows with the node count, sparse large numbers go to the map instead
+        long number;
+        if (isIntegerName(name, number) && number < (1 << 26) && (name.size() == 1 || name[0] != '0') &&
+            (size_t(number) < numericNodes.size() || size_t(number) < 2 * nodeNames.size() + 1024))
+        {
+            if (size_t(number) >= numericNodes.size())
+                numericNodes.resize(std::max<size_t>(number + 1, 2 * numericNodes.size()), 0);
+            int &local = numericNodes[number];
+            if (local == 0)
+            {
+                // Seen before the table reached it
+                auto it = localNodes.find(name);
+                if (it != localNodes.end())
+                    return local = it->second;
+                nodeNames.push_back(name);
+                local = nodeNames.size();
+            }
+            return local;
+        }
+
+        auto [it, inserted] = localNodes.emplace(name, int(nodeNames.size()) + 1);
+        if (inserted)
+            nodeNames.push_back(name);
+        return it->second;
+    }
+};
+
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &filename) : base(nullptr), length(0)
+    {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            length = info.st_size;
+            void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            base = mapped == MAP_FAILED ? nullptr : static_cast<const char *>(mapped);
+        }
+        ::close(fd);
+    }
+    ~MappedFile()
+    {
+        if (base)
+            munmap(const_cast<char *>(base), length);
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *begin() const { return base; }
+    const char *end() const { return base + length; }
+    bool isOpen() const { return base != nullptr; }
+
+private:
+    const char *base;
+    size_t length;
+};
+
+class NetlistParser
+{
+public:
+    NetlistParser(const std::string &filename) : filename(filename) {}
+
+    bool parse(const char *begin, const char *end, NetlistInfo &info)
+    {
+        Lexer lexer(begin, end);
+        info.title = std::string(lexer.titleLine());
+
+        subckts.emplace_back(); // index 0 is the top level
+        std::vector<int> stack{0};
+        std::vector<std::string_view> tokens;
+        size_t line = 0;
+        while (lexer.next(tokens, line))
+        {
+            std::string_view card = tokens[0];
+            Subckt &current = subckts[stack.back()];
+            if (card[0] == '.')
+            {
+                if (iequals(card, ".end"))
+                    break;
+                if (iequals(card, ".subckt"))
+                {
+                    if (tokens.size() < 2)
+                        return error(line, ".subckt without a name");
+                    subckts.emplace_back();
+                    Subckt &sub = subckts.back();
+                    sub.name = tokens[1];
+                    for (size_t i = 2; i < tokens.size(); ++i)
+                    {
+                        if (sub.node(tokens[i]) == 0)
+                            return error(line, "ground cannot be a subcircuit port");
+                    }
+                    sub.numPorts = sub.nodeNames.size();
+                    stack.push_back(subckts.size() - 1);
+                }
+                else if (iequals(card, ".ends"))
+                {
+                    if (stack.size() == 1)
+                        return error(line, ".ends without .subckt");
+                    stack.pop_back();
+                }
+                else if (iequals(card, ".model"))
+                {
+                    if (tokens.size() < 3)
+                        return error(line, "incomplete .model");
+                    if (iequals(tokens[2], "jj"))
+                    {
+                        JJParams &model = models[tokens[1]];
+                        if (!readParams(tokens, 3, model, line))
+                            return false;
+                    }
+                }
+                else if (iequals(card, ".tran"))
+                {
+                    if (tokens.size() < 3 || !parseValue(tokens[1], info.tranStep) || !parseValue(tokens[2], info.tranStop))
+                        return error(line, "expected .tran <step> <stop>");
+                }
+                // other control cards (.print, .options, ...) are ignored
+                continue;
+            }
+
+            char type = netlist_detail::lower(card[0]);
+            if (type == 'x')
+            {
+                // X<name> nodes... subckt
+                if (tokens.size() < 2)
+                    return error(line, "incomplete subcircuit instance");
+                Instance instance{tokens.back(), int(current.instanceNodes.size()), int(tokens.size()) - 2, -1, line};
+                for (size_t i = 1; i + 1 < tokens.size(); ++i)
+                    current.instanceNodes.push_back(current.node(tokens[i]));
+                current.instances.push_back(instance);
+                continue;
+            }
+
+            Element element{char(type - 'a' + 'A'), 0, 0, 0.0, {}, {}, line};
+            if (tokens.size() < 3)
+                return error(line, "expected two nodes");
+            element.n1 = current.node(tokens[1]);
+            element.n2 = current.node(tokens[2]);
+            switch (type)
+            {
+            case 'r':
+            case 'l':
+            case 'c':
+                if (tokens.size() < 4 || !parseValue(tokens[3], element.value))
+                    return error(line, "expected a value");
+                break;
+            case 'v':
+            {
+                size_t i = 3;
+                if (i < tokens.size() && iequals(tokens[i], "dc"))
+                    ++i;
+                if (i >= tokens.size() || !parseValue(tokens[i], element.value))
+                    return error(line, "expected a source value");
+                break;
+            }
+            case 'b':
+            {
+                size_t i = 3;
+                double number;
+                if (i < tokens.size() && !isParam(tokens[i]) && !parseValue(tokens[i], number))
+                    element.model = tokens[i++];
+                if (!readParams(tokens, i, element.params, line))
+                    return false;
+                break;
+            }
+            default:
+                return error(line, "unsupported card " + std::string(card));
+            }
+            current.elements.push_back(element);
+        }
+        if (stack.size() != 1)
+            return error(line, "missing .ends");
+
+        // Resolve the subcircuit of every instance and the model of every junction
+        NameMap<int> byName;
+        for (size_t s = 1; s < subckts.size(); ++s)
+            byName.emplace(subckts[s].name, int(s));
+        for (Subckt &sub : subckts)
+        {
+            for (Instance &instance : sub.instances)
+            {
+                auto it = byName.find(instance.subckt);
+                if (it == byName.end())
+                    return error(instance.line, "unknown subcircuit " + std::string(instance.subckt));
+                instance.resolved = it->second;
+                if (instance.numNodes != subckts[it->second].numPorts)
+                    return error(instance.line, "port count does not match subcircuit " + std::string(instance.subckt));
+            }
+            for (Element &element : sub.elements)
+            {
+                if (element.type != 'B')
+                    continue;
+                if (!element.model.empty())
+                {
+                    auto it = models.find(element.model);
+                    if (it == models.end())
+                        return error(element.line, "unknown model " + std::string(element.model));
+                    element.params.inherit(it->second);
+                }
+                JJParams &p = element.params;
+                if (std::isnan(p.icrit) || std::isnan(p.r) || std::isnan(p.cap))
+                    return error(element.line, "junction needs icrit, r (or rn, r0) and cap");
+                double area = std::isnan(p.area) ? 1.0 : p.area;
+                p.icrit *= area;
+                p.cap *= area;
+                p.r /= area;
+            }
+        }
+        return true;
+    }
+
+    // Number the top level nodes, then expand every subcircuit into the circuit
+    bool build(Circuit &circuit, NetlistInfo &info, double timeStep)
+    {
+        size_t total = 0;
+        if (!count(0, total))
+            return false;
+        circuit.reserve(circuit.getNumComponents() + total);
+
+        // Integer names keep their numeric order, the others follow in order of appearance
+        Subckt &top = subckts[0];
+        int base = circuit.getNumNodes();
+        std::vector<std::pair<long, int>> numeric; // (number, local index)
+        for (size_t i = 0; i < top.nodeNames.size(); ++i)
+        {
+            long number;
+            if (isIntegerName(top.nodeNames[i], number))
+                numeric.emplace_back(number, int(i) + 1);
+        }
+        std::sort(numeric.begin(), numeric.end());
+        std::vector<int> map(top.nodeNames.size() + 1, 0);
+        nextNode = base;
+        for (const auto &[number, local] : numeric)
+            map[local] = ++nextNode;
+        for (size_t i = 1; i < map.size(); ++i)
+        {
+            if (map[i] == 0)
+                map[i] = ++nextNode;
+        }
+        info.nodeNames.assign(nextNode + 1, std::string());
+        for (size_t i = 0; i < top.nodeNames.size(); ++i)
+            info.nodeNames[map[i + 1]].assign(top.nodeNames[i].data(), top.nodeNames[i].size());
+
+        nextSource = circuit.getNumVoltageSources();
+        this->timeStep = timeStep;
+        expand(circuit, 0, map);
+        info.numComponents = total;
+        return true;
+    }
+
+private:
+    static bool isParam(std::string_view token)
+    {
+        for (const char *key : {"icrit", "ic", "r", "rn", "r0", "cap", "c", "area"})
+            if (iequals(token, key))
+                return true;
+        return false;
+    }
+
+    bool readParams(const std::vector<std::string_view> &tokens, size_t i, JJParams &params, size_t line)
+    {
+        for (; i + 1 < tokens.size(); i += 2)
+        {
+            double value;
+            if (!parseValue(tokens[i + 1], value))
+                return error(line, "bad value for " + std::string(tokens[i]));
+            params.set(tokens[i], value);
+        }
+        if (i < tokens.size())
+            return error(line, "parameter " + std::string(tokens[i]) + " without a value");
+        return true;
+    }
+
+    // Components of a subcircuit after expansion, detects recursive definitions
+    bool count(int s, size_t &total)
+    {
+        Subckt &sub = subckts[s];
+        if (sub.counting)
+            return error(0, "recursive subcircuit " + std::string(sub.name));
+        if (sub.count == 0)
+        {
+            sub.counting = true;
+            size_t n = sub.elements.size();
+            for (const Instance &instance : sub.instances)
+            {
+                size_t child = 0;
+                if (!count(instance.resolved, child))
+                    return false;
+                n += child;
+            }
+            sub.counting = false;
+            sub.count = n;
+        }
+        total = sub.count;
+        return true;
+    }
+
+    // map: local node index -> circuit node
+    void expand(Circuit &circuit, int s, const std::vector<int> &map)
+    {
+        const Subckt &sub = subckts[s];
+        for (const Element &e : sub.elements)
+        {
+            int n1 = map[e.n1], n2 = map[e.n2];
+            switch (e.type)
+            {
+            case 'R': circuit.emplaceComponent<Resistor>(n1, n2, e.value); break;
+            case 'L': circuit.emplaceComponent<Inductor>(n1, n2, e.value, timeStep); break;
+            case 'C': circuit.emplaceComponent<Capacitor>(n1, n2, e.value, timeStep); break;
+            case 'V': circuit.emplaceComponent<VoltageSource>(n1, n2, e.value, nextSource++); break;
+            case 'B':
+                circuit.emplaceComponent<JosephsonJunction>(n1, n2, ++nextNode, e.params.icrit, e.params.r,
+                                                            e.params.cap, timeStep);
+                break;
+            }
+        }
+        for (const Instance &instance : sub.instances)
+        {
+            const Subckt &child = subckts[instance.resolved];
+            std::vector<int> childMap(child.nodeNames.size() + 1, 0);
+            for (int p = 0; p < instance.numNodes; ++p)
+                childMap[p + 1] = map[sub.instanceNodes[instance.firstNode + p]];
+            for (size_t i = child.numPorts + 1; i < childMap.size(); ++i)
+                childMap[i] = ++nextNode;
+            expand(circuit, instance.resolved, childMap);
+        }
+    }
+
+    bool error(size_t line, const std::string &message)
+    {
+        std::cerr << "Error: " << filename;
+        if (line > 0)
+            std::cerr << ":" << line;
+        std::cerr << ": " << message << std::endl;
+        return false;
+    }
+
+    std::string filename;
+    std::vector<Subckt> subckts;
+    NameMap<JJParams> models;
+    int nextNode = 0;
+    int nextSource = 0;
+    double timeStep = 0.0;
+};
+} // namespace netlist_detail
+
+inline int NetlistInfo::nodeIndex(std::string_view name) const
+{
+    if (name == "0" || netlist_detail::iequals(name, "gnd"))
+        return 0;
+    for (size_t i = 1; i < nodeNames.size(); ++i)
+        if (netlist_detail::iequals(nodeNames[i], name))
+            return i;
+    return -1;
+}
+
+// Load a netlist into circuit (normally empty, nodes and sources are numbered after the
+// existing ones). timeStep is the dt handed to the reactive components when the netlist
+// has no .tran card. Returns false and reports the line on errors.
+inline bool loadNetlist(const std::string &filename, Circuit &circuit, NetlistInfo *info = nullptr, double timeStep = 1e-12)
+{
+    netlist_detail::MappedFile file(filename);
+    if (!file.isOpen())
+    {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        return false;
+    }
+
+    NetlistInfo local;
+    NetlistInfo &out = info ? *info : local;
+    netlist_detail::NetlistParser parser(filename);
+    if (!parser.parse(file.begin(), file.end(), out))
+        return false;
+    return parser.build(circuit, out, out.tranStep > 0.0 ? out.tranStep : timeStep);
+}
+
+#endif // NETLIST_H
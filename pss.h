@@ -0,0 +1,267 @@
+#ifndef PSS_H
+#define PSS_H
+
+#include "circulator_simulator.h"
+
+// pss.h
+// Periodic steady state of a circuit driven with period T, by shooting. The integration
+// history of the components (capacitor and inductor voltages and currents, junction voltages
+// and phases, see StateKind) is the state s, and one period of transient maps it to Phi(s).
+// Newton's method solves Phi(s) = s for the periodic orbit directly, instead of simulating
+// the startup until it has decayed:
+//
+//   PeriodicSteadyState pss(circuit);
+//   if (pss.run(period, timeStep))
+//       circuit.saveResultsToFile("pss.txt"); // one period on the orbit
+//
+// The Newton system (dPhi/ds - I) ds = s - Phi(s) is solved with GMRES, every product with
+// the sensitivity dPhi/ds is a finite difference of one more period from a perturbed state.
+// Fast decaying modes barely show in dPhi/ds, so the Krylov iterations only resolve the slow
+// ones: a linear circuit converges in one Newton step of a few periods. Junction phases only
+// have to return modulo 2 pi, so orbits in the voltage state are found as well.
+//
+// The period has to be a multiple of the time step, every shot integrates exactly
+// period / timeStep steps. With Gear2 the shooting has to start after t = 0, where the
+// first step is backward Euler; the default warm-up period does that.
+
+struct PSSOptions
+{
+    int warmupPeriods = 1;  // plain transient periods before shooting, they give the first guess
+    int maxIterations = 20; // Newton iterations
+    int maxKrylov = 100;    // GMRES iterations per Newton step
+    double krylovTol = 1e-4; // relative residual of the GMRES solves
+    double reltol = 1e-6;
+    double vntol = 1e-9;    // voltages [V], rates use vntol per time step
+    double abstol = 1e-12;  // currents [A]
+    double phasetol = 1e-9; // junction phases [rad]
+};
+
+class PeriodicSteadyState
+{
+public:
+    PeriodicSteadyState(Circuit &circuit) : circuit(circuit), steps(0), endTime(0.0), iterations(0), periods(0), residual(0.0) {}
+
+    // Shoots from the circuit's current state. Afterwards the circuit holds the results of
+    // one period on the orbit, or streams them to its sink, and its state is at the end of
+    // that period. Returns false if Newton did not converge, the period is then simulated
+    // from the last iterate.
+    bool run(double period, double timeStep, const PSSOptions &options = PSSOptions())
+    {
+        iterations = 0;
+        periods = 0;
+        residual = 0.0;
+        if (!(period > 0.0) || !(timeStep > 0.0))
+        {
+            std::cerr << "Error: periodic steady state needs a positive period and time step" << std::endl;
+            return false;
+        }
+        steps = std::llround(period / timeStep);
+        if (steps < 1 || std::abs(steps * timeStep - period) > 1e-9 * period)
+        {
+            std::cerr << "Error: periodic steady state needs a period that is a multiple of the time step" << std::endl;
+            return false;
+        }
+
+        // Shooting runs on a copy without results, from the state of the circuit
+        Discard discard;
+        std::unique_ptr<Circuit> work = circuit.clone();
+        work->restoreCheckpoint(circuit.getCheckpoint());
+        work->setResultSink(&discard);
+        if (options.warmupPeriods > 0)
+        {
+            // One run, so only its first step starts at the initial time
+            work->runTransient(stopTime(work->getTime(), options.warmupPeriods, timeStep), timeStep);
+            periods += options.warmupPeriods;
+        }
+        base = work->getCheckpoint();
+        endTime = stopTime(base.time, 1, timeStep);
+
+        // Select the history values and their tolerances
+        std::vector<StateKind> kinds;
+        for (size_t i = 0; i < work->getNumComponents(); ++i)
+            work->getComponent(i)->appendStateKinds(kinds);
+        if (kinds.size() != base.state.size())
+        {
+            std::cerr << "Error: state kinds do not match the component state" << std::endl;
+            return false;
+        }
+        index.clear();
+        phase.clear();
+        std::vector<double> tolerances;
+        for (size_t i = 0; i < kinds.size(); ++i)
+        {
+            if (kinds[i] == StateKind::Parameter)
+                continue;
+            index.push_back(i);
+            phase.push_back(kinds[i] == StateKind::Phase);
+            tolerances.push_back(kinds[i] == StateKind::Voltage ? options.vntol
+                                 : kinds[i] == StateKind::Current ? options.abstol
+                                 : kinds[i] == StateKind::Rate ? options.vntol / timeStep
+                                                               : options.phasetol);
+        }
+        int m = index.size();
+        absTol = Eigen::Map<Eigen::VectorXd>(tolerances.data(), m);
+
+        // Newton on r(s) = Phi(s) - s, in units scaled by D = diag(max(|s|, abstol / reltol))
+        Eigen::VectorXd s(m), F, r;
+        for (int k = 0; k < m; ++k)
+            s[k] = base.state[index[k]];
+        bool ok = m == 0;
+        bool valid = ok || shoot(*work, s, timeStep, F);
+        if (!ok && valid)
+            ok = converged(s, F, options, r);
+        while (!ok && valid && iterations < options.maxIterations)
+        {
+            Eigen::VectorXd D = s.cwiseAbs().cwiseMax(absTol / options.reltol);
+            Eigen::VectorXd b = -r.cwiseQuotient(D);
+            Eigen::VectorXd scaled = s.cwiseQuotient(D);
+            double eps = 1e-7 * (1.0 + scaled.norm());
+            auto apply = [&](const Eigen::VectorXd &v, Eigen::VectorXd &out) {
+                Eigen::VectorXd Fp;
+                if (!shoot(*work, s + eps * D.cwiseProduct(v), timeStep, Fp))
+                    return false;
+                out = (Fp - F).cwiseQuotient(eps * D) - v;
+                return true;
+            };
+            Eigen::VectorXd step;
+            if (!gmres(apply, b, options, step))
+                break;
+
+            // Halve the step while it does not reduce the scaled residual
+            double before = b.norm();
+            Eigen::VectorXd sNew, FNew, rNew;
+            double lambda = 1.0;
+            bool done = false;
+            valid = false;
+            for (int tries = 0; tries < 4 && !valid; ++tries, lambda *= 0.5)
+            {
+                sNew = s + lambda * D.cwiseProduct(step);
+                if (!shoot(*work, sNew, timeStep, FNew))
+                    continue;
+                done = converged(sNew, FNew, options, rNew);
+                valid = done || rNew.cwiseQuotient(D).norm() < before || tries == 3;
+            }
+            iterations++;
+            if (!valid)
+                break;
+            s = sNew;
+            F = FNew;
+            r = rNew;
+            ok = done;
+        }
+
+        // One period from the orbit on the circuit itself, into its results or sink
+        circuit.restoreCheckpoint(stateOf(s));
+        circuit.runTransient(endTime, timeStep);
+        periods++;
+        if (!ok)
+            std::cerr << "Warning: periodic steady state did not converge, residual " << residual << " of the tolerance" << std::endl;
+        return ok;
+    }
+
+    int getIterations() const { return iterations; } // Newton iterations of the last run
+    long getPeriods() const { return periods; }      // periods simulated, warm-up and the final one included
+    double getResidual() const { return residual; }  // largest |Phi(s) - s| relative to its tolerance
+
+private:
+    class Discard : public ResultSink
+    {
+    public:
+        void record(double, const Eigen::VectorXd &) override {}
+    };
+
+    // End time for runTransient that takes exactly count periods of steps from start; the
+    // loop adds up t += timeStep, half a step of margin keeps the rounding from adding one
+    double stopTime(double start, int count, double timeStep) const
+    {
+        return start + (count * steps - 0.5) * timeStep;
+    }
+
+    Checkpoint stateOf(const Eigen::VectorXd &s) const
+    {
+        Checkpoint checkpoint = base;
+        for (size_t k = 0; k < index.size(); ++k)
+            checkpoint.state[index[k]] = s[k];
+        return checkpoint;
+    }
+
+    // F = Phi(s), one period from the base time
+    bool shoot(Circuit &work, const Eigen::VectorXd &s, double timeStep, Eigen::VectorXd &F)
+    {
+        if (!work.restoreCheckpoint(stateOf(s)))
+            return false;
+        work.runTransient(endTime, timeStep);
+        periods++;
+        Checkpoint end = work.getCheckpoint();
+        F.resize(index.size());
+        for (size_t k = 0; k < index.size(); ++k)
+            F[k] = end.state[index[k]];
+        return F.allFinite();
+    }
+
+    // r = Phi(s) - s with phases wrapped to (-pi, pi], and whether every entry is within tolerance
+    bool converged(const Eigen::VectorXd &s, const Eigen::VectorXd &F, const PSSOptions &options, Eigen::VectorXd &r)
+    {
+        r = F - s;
+        residual = 0.0;
+        for (int k = 0; k < r.size(); ++k)
+        {
+            if (phase[k])
+                r[k] -= 2 * M_PI * std::round(r[k] / (2 * M_PI));
+            double tolerance = options.reltol * std::max(std::abs(s[k]), std::abs(F[k])) + absTol[k];
+            residual = std::max(residual, std::abs(r[k]) / tolerance);
+        }
+        return residual <= 1.0;
+    }
+
+    // Matrix-free GMRES from x = 0, Arnoldi with modified Gram-Schmidt and a least squares
+    // solve of the small Hessenberg system
+    template <typename Apply>
+    bool gmres(Apply &apply, const Eigen::VectorXd &b, const PSSOptions &options, Eigen::VectorXd &x)
+    {
+        int m = b.size();
+        int kmax = std::min(m, options.maxKrylov);
+        double beta = b.norm();
+        x = Eigen::VectorXd::Zero(m);
+        if (beta == 0.0)
+            return true;
+        Eigen::MatrixXd V(m, kmax + 1), H = Eigen::MatrixXd::Zero(kmax + 1, kmax);
+        V.col(0) = b / beta;
+        Eigen::VectorXd w, y;
+        int k = 0;
+        while (k < kmax)
+        {
+            if (!apply(V.col(k), w))
+                return false;
+            for (int i = 0; i <= k; ++i)
+            {
+                H(i, k) = V.col(i).dot(w);
+                w -= H(i, k) * V.col(i);
+            }
+            H(k + 1, k) = w.norm();
+            ++k;
+            Eigen::VectorXd e = Eigen::VectorXd::Zero(k + 1);
+            e[0] = beta;
+            y = H.topLeftCorner(k + 1, k).colPivHouseholderQr().solve(e);
+            double remaining = (e - H.topLeftCorner(k + 1, k) * y).norm();
+            if (remaining <= options.krylovTol * beta || H(k, k - 1) <= 1e-14 * beta)
+                break;
+            V.col(k) = w / H(k, k - 1);
+        }
+        x = V.leftCols(k) * y;
+        return x.allFinite();
+    }
+
+    Circuit &circuit;
+    Checkpoint base;         // state after the warm-up, the shooting varies its history values
+    long long steps;         // time steps per period
+    double endTime;          // stopTime of one period from the base
+    std::vector<size_t> index; // positions of the history values in Checkpoint::state
+    std::vector<bool> phase;
+    Eigen::VectorXd absTol;
+    int iterations;
+    long periods;
+    double residual;
+};
+
+#endif // PSS_H
@@ -1,13 +1,99 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
 #include <stdlib.h>
+#include <cmath>
+#include <cstdint>
 
 #define RAND_SEED 123
 
-void init_random(){
+inline void init_random(){
 	srand(RAND_SEED);
 }
 
-unsigned short random_ushort(){
+inline unsigned short random_ushort(){
 	return rand();
 }
 
+// Counter-based Philox4x32-10 generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+// The output is a pure function of (key, counter): every stream is identified by its
+// (seed, stream) pair, so threads need no shared state and a Monte Carlo sample draws the
+// same numbers whichever worker runs it. Each stream has 2^64 blocks of four 32-bit words.
+class Philox
+{
+public:
+	Philox(uint64_t seed = RAND_SEED, uint64_t stream = 0)
+		: key{uint32_t(seed), uint32_t(seed >> 32)},
+		  counter{0, 0, uint32_t(stream), uint32_t(stream >> 32)}, used(4), hasSpare(false), spare(0.0) {}
+
+	uint32_t next32(){
+		if (used == 4) {
+			generate();
+			used = 0;
+		}
+		return output[used++];
+	}
+
+	uint64_t next64(){
+		uint64_t hi = next32();
+		return (hi << 32) | next32();
+	}
+
+	// Uniform in [0, 1) with 53 random bits
+	double uniform(){
+		return (next64() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	// Standard normal by Box-Muller, the second value of each pair is kept for the next call
+	double normal(){
+		if (hasSpare) {
+			hasSpare = false;
+			return spare;
+		}
+		double u1 = 1.0 - uniform(); // (0, 1], keeps log finite
+		double u2 = uniform();
+		double r = std::sqrt(-2.0 * std::log(u1));
+		spare = r * std::sin(2.0 * M_PI * u2);
+		hasSpare = true;
+		return r * std::cos(2.0 * M_PI * u2);
+	}
+
+	double normal(double mean, double stddev){
+		return mean + stddev * normal();
+	}
+
+private:
+	static void mulhilo(uint32_t a, uint32_t b, uint32_t &hi, uint32_t &lo){
+		uint64_t product = uint64_t(a) * b;
+		hi = uint32_t(product >> 32);
+		lo = uint32_t(product);
+	}
+
+	// Ten rounds on the current counter, then increment its low 64 bits
+	void generate(){
+		uint32_t c[4] = {counter[0], counter[1], counter[2], counter[3]};
+		uint32_t k[2] = {key[0], key[1]};
+		for (int round = 0; round < 10; ++round) {
+			uint32_t hi0, lo0, hi1, lo1;
+			mulhilo(0xD2511F53u, c[0], hi0, lo0);
+			mulhilo(0xCD9E8D57u, c[2], hi1, lo1);
+			uint32_t next[4] = {hi1 ^ c[1] ^ k[0], lo1, hi0 ^ c[3] ^ k[1], lo0};
+			c[0] = next[0]; c[1] = next[1]; c[2] = next[2]; c[3] = next[3];
+			k[0] += 0x9E3779B9u;
+			k[1] += 0xBB67AE85u;
+		}
+		for (int i = 0; i < 4; ++i)
+			output[i] = c[i];
+		if (++counter[0] == 0)
+			++counter[1];
+	}
+
+	uint32_t key[2];
+	uint32_t counter[4];
+	uint32_t output[4];
+	int used;
+	bool hasSpare;
+	double spare;
+};
 
+#endif // RANDOM_H
@@ -0,0 +1,235 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "circulator_simulator.h"
+#include "thread_pool.h"
+
+// sweep.h
+// DC and bias sweeps. One or more component values are stepped over a grid and the
+// operating point (Circuit::runOperatingPoint) is solved at every grid point:
+//
+//   Sweep sweep(circuit, {SweepParameter::value(0, SweepParameter::linear(0.0, 5.0, 1001)),
+//                         SweepParameter::criticalCurrent(2, {1e-4, 2e-4})});
+//   sweep.run(options);
+//   sweep.getResults().saveToFile("sweep.txt");
+//
+// The grid is visited in row major order, the last parameter varying fastest, and cut into
+// contiguous segments that run in parallel, each on its own clone of the prototype. Inside
+// a segment consecutive points are neighbours on the grid: a linear circuit swept over
+// source values factorizes once per segment and only restamps z, a nonlinear one starts
+// Newton-Raphson from the solution of the previous point.
+
+// A swept quantity of one component, addressed by its index in the order of addComponent
+struct SweepParameter
+{
+    enum class Kind { Value, CriticalCurrent };
+    Kind kind;
+    size_t component;
+    std::vector<double> values;
+
+    // Component::setValue: R, L, C or the value of a voltage source
+    static SweepParameter value(size_t component, std::vector<double> values)
+    {
+        return {Kind::Value, component, std::move(values)};
+    }
+    // I_c of a JosephsonJunction
+    static SweepParameter criticalCurrent(size_t component, std::vector<double> values)
+    {
+        return {Kind::CriticalCurrent, component, std::move(values)};
+    }
+
+    // count equidistant values from start to stop, both included
+    static std::vector<double> linear(double start, double stop, size_t count)
+    {
+        std::vector<double> values(count, start);
+        for (size_t i = 1; i < count; ++i)
+            values[i] = start + (stop - start) * double(i) / double(count - 1);
+        return values;
+    }
+
+    std::string label() const
+    {
+        return (kind == Kind::Value ? "Value" : "Ic") + std::to_string(component);
+    }
+
+    // Checks that the component exists and has the swept quantity, reports why not
+    bool fits(Circuit &circuit) const
+    {
+        if (component >= circuit.getNumComponents())
+        {
+            std::cerr << "Error: sweep parameter " << label() << " does not fit the circuit" << std::endl;
+            return false;
+        }
+        bool junction = dynamic_cast<JosephsonJunction *>(circuit.getComponent(component)) != nullptr;
+        if (kind == Kind::Value && junction)
+        {
+            // A junction does not stamp its value, sweep SweepParameter::criticalCurrent instead
+            std::cerr << "Error: sweep parameter " << label()
+                      << " sets the value of a Josephson junction, which does not use it; sweep its critical current" << std::endl;
+            return false;
+        }
+        if (kind == Kind::CriticalCurrent && !junction)
+        {
+            std::cerr << "Error: sweep parameter " << label() << " needs a Josephson junction" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Only the RHS of the operating point depends on the value of a voltage source
+    bool rhsOnly(Circuit &circuit) const
+    {
+        return kind == Kind::Value && circuit.getComponent(component)->isVoltageSource();
+    }
+
+    void apply(Circuit &circuit, double v) const
+    {
+        Component *target = circuit.getComponent(component);
+        if (kind == Kind::Value)
+            target->setValue(v);
+        else
+            static_cast<JosephsonJunction *>(target)->setCriticalCurrent(v);
+    }
+};
+
+// One row per grid point: the parameter values, the selected probes and whether the
+// operating point converged
+class SweepTable
+{
+public:
+    size_t numPoints() const { return converged.size(); }
+    const std::vector<std::string> &getParameters() const { return labels; }
+    const std::vector<Probe> &getProbes() const { return probes; }
+    double parameter(size_t point, size_t k) const { return parameters[point * labels.size() + k]; }
+    double value(size_t point, size_t probe) const { return values[point * probes.size() + probe]; }
+    bool isConverged(size_t point) const { return converged[point] != 0; }
+
+    void saveToFile(const std::string &filename) const
+    {
+        std::ofstream file(filename);
+        if (!file.is_open())
+        {
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return;
+        }
+
+        // Write header
+        for (const auto &label : labels)
+            file << label << ", ";
+        for (const auto &probe : probes)
+            file << probe.label() << ", ";
+        file << "Converged\n";
+
+        // Write data
+        for (size_t point = 0; point < numPoints(); ++point)
+        {
+            for (size_t k = 0; k < labels.size(); ++k)
+                file << parameter(point, k) << ", ";
+            for (size_t p = 0; p < probes.size(); ++p)
+                file << value(point, p) << ", ";
+            file << (isConverged(point) ? 1 : 0) << "\n";
+        }
+    }
+
+private:
+    friend class Sweep;
+
+    std::vector<std::string> labels;
+    std::vector<Probe> probes;
+    std::vector<double> parameters; // row major, one row per point
+    std::vector<double> values;     // row major, one row per point
+    std::vector<char> converged;
+};
+
+struct SweepOptions
+{
+    unsigned threads = 0;      // 0: one per hardware thread
+    size_t segments = 0;       // 0: one per thread, more balance uneven points at the cost of cold starts
+    std::vector<Probe> probes; // empty: every node voltage and source current
+};
+
+class Sweep
+{
+public:
+    Sweep(const Circuit &prototype, std::vector<SweepParameter> parameters)
+        : prototype(prototype), parameters(std::move(parameters)) {}
+
+    // Operating point of every grid point, false if a parameter does not fit the circuit
+    bool run(const SweepOptions &options = SweepOptions())
+    {
+        // Check the parameters and resolve the probes on a scratch copy of the prototype
+        std::unique_ptr<Circuit> scratch = prototype.clone();
+        size_t points = parameters.empty() ? 0 : 1;
+        bool rhsOnly = true;
+        results = SweepTable();
+        for (const auto &parameter : parameters)
+        {
+            if (!parameter.fits(*scratch))
+                return false;
+            rhsOnly = rhsOnly && parameter.rhsOnly(*scratch);
+            points *= parameter.values.size();
+            results.labels.push_back(parameter.label());
+        }
+        int numNodes = scratch->getNumNodes();
+        results.probes = options.probes;
+        if (results.probes.empty())
+        {
+            for (int node = 1; node <= numNodes; ++node)
+                results.probes.push_back(Probe::nodeVoltage(node));
+            for (int v = 0; v < scratch->getNumVoltageSources(); ++v)
+                results.probes.push_back(Probe::sourceCurrent(v));
+        }
+        std::vector<int> indices;
+        for (const auto &probe : results.probes)
+            indices.push_back(probe.index(numNodes));
+
+        results.parameters.resize(points * parameters.size());
+        results.values.resize(points * indices.size());
+        results.converged.resize(points);
+        if (points == 0)
+            return true;
+
+        // Segments write disjoint rows of the table, no merge is needed
+        ThreadPool pool(options.threads);
+        size_t segments = std::min(points, options.segments > 0 ? options.segments : size_t(pool.size()));
+        pool.parallelFor(segments, [&](size_t segment, unsigned) {
+            size_t begin = segment * points / segments, end = (segment + 1) * points / segments;
+            std::unique_ptr<Circuit> circuit = prototype.clone();
+            bool reuse = false;
+            for (size_t point = begin; point < end; ++point)
+            {
+                double *row = &results.parameters[point * parameters.size()];
+                size_t rest = point;
+                for (size_t k = parameters.size(); k-- > 0;)
+                {
+                    const std::vector<double> &values = parameters[k].values;
+                    row[k] = values[rest % values.size()];
+                    rest /= values.size();
+                    parameters[k].apply(*circuit, row[k]);
+                }
+
+                bool ok = circuit->runOperatingPoint(reuse);
+                const Eigen::VectorXd &x = circuit->getSolution();
+                double *out = &results.values[point * indices.size()];
+                for (size_t p = 0; p < indices.size(); ++p)
+                    out[p] = indices[p] >= 0 ? x[indices[p]] : 0.0;
+                results.converged[point] = ok;
+
+                // A point without solution is no starting point, the next one starts cold
+                reuse = ok && rhsOnly;
+                if (!ok)
+                    circuit = prototype.clone();
+            }
+        });
+        return true;
+    }
+
+    const SweepTable &getResults() const { return results; }
+
+private:
+    const Circuit &prototype;
+    std::vector<SweepParameter> parameters;
+    SweepTable results;
+};
+
+#endif // SWEEP_H
@@ -0,0 +1,151 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// thread_pool.h
+// Work-stealing pool for independent simulations (ensembles, sweeps). parallelFor deals
+// the indices round-robin into one deque per worker; a worker pops from the back of its
+// own deque and, once empty, steals from the front of the others, so long and short
+// runs even out without a shared queue. The calling thread waits for the whole batch.
+//
+//   ThreadPool pool;                    // one worker per hardware thread
+//   pool.parallelFor(n, [&](size_t i, unsigned worker) { ... });
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threads = 0)
+        : queues(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+          job(nullptr), generation(0), remaining(0), active(0), stopping(false)
+    {
+        for (auto &queue : queues)
+            queue = std::make_unique<WorkQueue>();
+        for (unsigned w = 0; w < queues.size(); ++w)
+            workers.emplace_back(&ThreadPool::workerLoop, this, w);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned size() const { return queues.size(); }
+
+    // Runs fn(index, worker) for every index in [0, count), worker is in [0, size())
+    void parallelFor(size_t count, const std::function<void(size_t, unsigned)> &fn)
+    {
+        if (count == 0)
+            return;
+        for (unsigned w = 0; w < queues.size(); ++w)
+        {
+            std::lock_guard<std::mutex> lock(queues[w]->mutex);
+            for (size_t i = w; i < count; i += queues.size())
+                queues[w]->items.push_back(i);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        job = &fn;
+        remaining = count;
+        ++generation;
+        wake.notify_all();
+        done.wait(lock, [this] { return remaining == 0 && active == 0; });
+        job = nullptr;
+    }
+
+private:
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<size_t> items;
+    };
+
+    bool pop(unsigned w, size_t &index)
+    {
+        WorkQueue &own = *queues[w];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.items.empty())
+            return false;
+        index = own.items.back();
+        own.items.pop_back();
+        return true;
+    }
+
+    bool steal(unsigned w, size_t &index)
+    {
+        for (unsigned k = 1; k < queues.size(); ++k)
+        {
+            WorkQueue &victim = *queues[(w + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.items.empty())
+            {
+                index = victim.items.front();
+                victim.items.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(unsigned w)
+    {
+        size_t seen = 0;
+        for (;;)
+        {
+            const std::function<void(size_t, unsigned)> *fn;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+                fn = job;
+                if (!fn)
+                    continue; // woke after the batch was finished
+                ++active;
+            }
+
+            size_t index, finished = 0;
+            while (pop(w, index) || steal(w, index))
+            {
+                (*fn)(index, w);
+                ++finished;
+            }
+
+            // The batch only ends once no worker is still scanning the queues with its job
+            std::lock_guard<std::mutex> lock(mutex);
+            remaining -= finished;
+            --active;
+            if (remaining == 0 && active == 0)
+                done.notify_one();
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t, unsigned)> *job;
+    size_t generation;
+    size_t remaining;
+    unsigned active; // workers inside the current batch
+    bool stopping;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,18 @@
+#include "waveform.h"
+#include <iostream>
+
+// Convert a binary waveform written by WaveformRecorder to the text format used by gnuplot
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <input.wave> <output.txt>" << std::endl;
+        return 1;
+    }
+
+    if (!convertWaveformToText(argv[1], argv[2])) {
+        return 1;
+    }
+
+    std::cout << "Converted " << argv[1] << " to " << argv[2] << std::endl;
+    return 0;
+}
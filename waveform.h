@@ -0,0 +1,488 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include "circulator_simulator.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+
+// waveform.h
+// Streaming recorder for long transient runs. Only the selected probes are kept,
+// samples go into a fixed-size buffer which is handed to a background writer thread
+// when it is full, so memory use does not grow with the simulated duration.
+//
+//   WaveformRecorder recorder("jj.txt", {Probe::nodeVoltage(1), Probe::junctionPhase(2)});
+//   circuit.setResultSink(&recorder);
+//   circuit.runTransient_jj(endTime, timeStep);
+//
+// Besides the comma separated text of saveResultsToFile the recorder can write a
+// columnar binary file, all integers and values in native (little-endian) byte order:
+//
+//   header:  char magic[8] = "CIRWAVE", uint32 version, uint32 numSignals,
+//            per signal: uint32 type (0 = float64, 1 = float32),
+//                        uint32 length + name, uint32 length + unit,
+//            zero padding to a multiple of 8 bytes
+//   chunk:   uint64 numRows, then per signal numRows contiguous values padded to 8 bytes
+//
+// Signal 0 is the time in float64, the probes follow in the selected precision.
+// Every buffer flush becomes one chunk, WaveformReader maps the file and hands out
+// the per-chunk arrays without copying them.
+enum class WaveformFormat { Text, Binary64, Binary32 };
+
+namespace waveform_detail
+{
+const char magic[8] = {'C', 'I', 'R', 'W', 'A', 'V', 'E', '\0'};
+const uint32_t version = 1;
+const uint32_t typeFloat64 = 0;
+const uint32_t typeFloat32 = 1;
+
+inline size_t padTo8(size_t bytes) { return (bytes + 7) & ~size_t(7); }
+
+inline void writePadding(std::ofstream &file, size_t bytes)
+{
+    static const char zeros[8] = {};
+    file.write(zeros, padTo8(bytes) - bytes);
+}
+
+inline size_t writeString(std::ofstream &file, const std::string &str)
+{
+    uint32_t length = str.size();
+    file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    file.write(str.data(), length);
+    return sizeof(length) + length;
+}
+} // namespace waveform_detail
+
+class WaveformRecorder : public ResultSink
+{
+public:
+    // An empty probe list records the full solution vector, like Circuit::saveResultsToFile
+    WaveformRecorder(const std::string &filename, std::vector<Probe> probes = {},
+                     WaveformFormat format = WaveformFormat::Text, size_t bufferRows = 4096)
+        : filename(filename), probes(std::move(probes)), recordAll(this->probes.empty()), format(format),
+          bufferRows(bufferRows > 0 ? bufferRows : 1), rowSize(0), pending(false), stopping(false) {}
+
+    ~WaveformRecorder() override { end(); }
+
+    WaveformRecorder(const WaveformRecorder &) = delete;
+    WaveformRecorder &operator=(const WaveformRecorder &) = delete;
+
+    bool isOpen() const { return file.is_open(); }
+
+    void begin(int numNodes, int numVoltageSources) override
+    {
+        end();
+
+        // Resolve the probes to solution indices, all signals if none were selected
+        if (recordAll)
+        {
+            probes.clear();
+            for (int node = 1; node <= numNodes; ++node)
+                probes.push_back(Probe::nodeVoltage(node));
+            for (int v = 0; v < numVoltageSources; ++v)
+                probes.push_back(Probe::sourceCurrent(v));
+        }
+        indices.clear();
+        for (const auto &probe : probes)
+        {
+            if (!probe.valid(numNodes, numVoltageSources))
+            {
+                std::cerr << "Error: probe " << probe.label() << " is not in the circuit, nothing is recorded" << std::endl;
+                return;
+            }
+            indices.push_back(probe.index(numNodes));
+        }
+
+        file.open(filename, format == WaveformFormat::Text ? std::ios::out : std::ios::out | std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return;
+        }
+
+        // Write header
+        if (format == WaveformFormat::Text)
+        {
+            file << "Time";
+            for (const auto &probe : probes)
+                file << ", " << probe.label();
+            file << "\n";
+        }
+        else
+        {
+            writeBinaryHeader();
+        }
+
+        // Two buffers of bufferRows rows each: one is filled while the other is written
+        rowSize = 1 + indices.size();
+        active.clear();
+        active.reserve(bufferRows * rowSize);
+        writing.clear();
+        writing.reserve(bufferRows * rowSize);
+        pending = false;
+        stopping = false;
+        writer = std::thread(&WaveformRecorder::writerLoop, this);
+    }
+
+    void record(double t, const Eigen::VectorXd &x) override
+    {
+        if (!writer.joinable())
+            return;
+        active.push_back(t);
+        for (int idx : indices)
+            active.push_back(idx >= 0 ? x[idx] : 0.0);
+        if (active.size() >= bufferRows * rowSize)
+            flush();
+    }
+
+    void end() override
+    {
+        if (!writer.joinable())
+            return;
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        writer.join();
+        file.close();
+    }
+
+private:
+    // Hand the active buffer to the writer thread, waits if the previous one is still being written
+    void flush()
+    {
+        if (active.empty())
+            return;
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return !pending; });
+        std::swap(active, writing);
+        pending = true;
+        lock.unlock();
+        cv.notify_all();
+        active.clear();
+    }
+
+    void writerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            cv.wait(lock, [this] { return pending || stopping; });
+            if (!pending)
+                break;
+
+            // The producer does not touch `writing` while pending is set
+            lock.unlock();
+            if (format == WaveformFormat::Text)
+                writeTextRows();
+            else
+                writeBinaryChunk();
+            file.flush();
+            lock.lock();
+
+            writing.clear();
+            pending = false;
+            cv.notify_all();
+        }
+    }
+
+    void writeTextRows()
+    {
+        for (size_t row = 0; row < writing.size(); row += rowSize)
+        {
+            file << writing[row];
+            for (size_t i = 1; i < rowSize; ++i)
+                file << ", " << writing[row + i];
+            file << "\n";
+        }
+    }
+
+    void writeBinaryHeader()
+    {
+        using namespace waveform_detail;
+        uint32_t numSignals = 1 + probes.size();
+        uint32_t probeType = format == WaveformFormat::Binary32 ? typeFloat32 : typeFloat64;
+        file.write(magic, sizeof(magic));
+        file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+        file.write(reinterpret_cast<const char *>(&numSignals), sizeof(numSignals));
+        size_t bytes = sizeof(magic) + sizeof(version) + sizeof(numSignals);
+
+        for (uint32_t i = 0; i < numSignals; ++i)
+        {
+            uint32_t type = i == 0 ? typeFloat64 : probeType;
+            file.write(reinterpret_cast<const char *>(&type), sizeof(type));
+            bytes += sizeof(type);
+            bytes += writeString(file, i == 0 ? "Time" : probes[i - 1].label());
+            bytes += writeString(file, i == 0 ? "s" : probes[i - 1].unit());
+        }
+        writePadding(file, bytes);
+    }
+
+    // Transpose the row buffer into one contiguous array per signal
+    void writeBinaryChunk()
+    {
+        uint64_t rows = writing.size() / rowSize;
+        file.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
+        for (size_t col = 0; col < rowSize; ++col)
+        {
+            if (col > 0 && format == WaveformFormat::Binary32)
+            {
+                column32.resize(rows);
+                for (size_t row = 0; row < rows; ++row)
+                    column32[row] = static_cast<float>(writing[row * rowSize + col]);
+                file.write(reinterpret_cast<const char *>(column32.data()), rows * sizeof(float));
+                waveform_detail::writePadding(file, rows * sizeof(float));
+            }
+            else
+            {
+                column64.resize(rows);
+                for (size_t row = 0; row < rows; ++row)
+                    column64[row] = writing[row * rowSize + col];
+                file.write(reinterpret_cast<const char *>(column64.data()), rows * sizeof(double));
+            }
+        }
+    }
+
+    std::string filename;
+    std::vector<Probe> probes;
+    bool recordAll;
+    WaveformFormat format;
+    std::vector<int> indices; // solution index of each probe
+    size_t bufferRows;
+    size_t rowSize;           // time + one value per probe
+    std::ofstream file;
+
+    std::vector<double> active;  // filled by the simulation thread
+    std::vector<double> writing; // owned by the writer thread while pending
+    std::vector<double> column64; // transposed column, writer thread only
+    std::vector<float> column32;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool pending;
+    bool stopping;
+};
+
+// Write the in-memory results of a finished run, e.g. to convert them to the binary format
+inline bool saveResultsToWaveform(const Circuit &circuit, const std::string &filename, WaveformFormat format)
+{
+    WaveformRecorder recorder(filename, {}, format);
+    recorder.begin(circuit.getNumNodes(), circuit.getNumVoltageSources());
+    if (!recorder.isOpen())
+        return false;
+    Eigen::VectorXd x;
+    for (const auto &[time, values] : circuit.getResults())
+    {
+        x = Eigen::Map<const Eigen::VectorXd>(values.data(), values.size());
+        recorder.record(time, x);
+    }
+    recorder.end();
+    return true;
+}
+
+// Non-owning view of a contiguous array inside the mapped file
+template <typename T>
+struct WaveformSpan
+{
+    const T *ptr = nullptr;
+    size_t count = 0;
+
+    const T *data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T &operator[](size_t i) const { return ptr[i]; }
+    const T *begin() const { return ptr; }
+    const T *end() const { return ptr + count; }
+};
+
+// Memory-mapped reader of the binary waveform format
+class WaveformReader
+{
+public:
+    explicit WaveformReader(const std::string &filename) : base(nullptr), length(0), totalRows(0)
+    {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            length = info.st_size;
+            void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            base = mapped == MAP_FAILED ? nullptr : static_cast<const char *>(mapped);
+        }
+        ::close(fd);
+        if (!base || !parse())
+        {
+            std::cerr << "Error: " << filename << " is not a waveform file" << std::endl;
+            unmap();
+        }
+    }
+
+    ~WaveformReader() { unmap(); }
+
+    WaveformReader(const WaveformReader &) = delete;
+    WaveformReader &operator=(const WaveformReader &) = delete;
+
+    bool isOpen() const { return base != nullptr; }
+    size_t numSignals() const { return signals.size(); }
+    const std::string &signalName(size_t sig) const { return signals[sig].name; }
+    const std::string &signalUnit(size_t sig) const { return signals[sig].unit; }
+    bool isFloat32(size_t sig) const { return signals[sig].type == waveform_detail::typeFloat32; }
+    size_t numChunks() const { return chunks.size(); }
+    size_t chunkRows(size_t chunk) const { return chunks[chunk].rows; }
+    size_t numRows() const { return totalRows; }
+
+    // Zero-copy array of one signal in one chunk, empty if T does not match the stored type
+    template <typename T>
+    WaveformSpan<T> signal(size_t chunk, size_t sig) const
+    {
+        WaveformSpan<T> span;
+        uint32_t type = std::is_same<T, float>::value ? waveform_detail::typeFloat32 : waveform_detail::typeFloat64;
+        if (signals[sig].type != type)
+            return span;
+        span.ptr = reinterpret_cast<const T *>(base + chunks[chunk].offsets[sig]);
+        span.count = chunks[chunk].rows;
+        return span;
+    }
+
+    double value(size_t chunk, size_t sig, size_t row) const
+    {
+        const char *column = base + chunks[chunk].offsets[sig];
+        if (isFloat32(sig))
+            return reinterpret_cast<const float *>(column)[row];
+        return reinterpret_cast<const double *>(column)[row];
+    }
+
+private:
+    struct Signal
+    {
+        uint32_t type;
+        std::string name;
+        std::string unit;
+    };
+    struct Chunk
+    {
+        size_t rows;
+        std::vector<size_t> offsets; // byte offset of each signal array
+    };
+
+    bool read(size_t &pos, void *out, size_t bytes) const
+    {
+        if (pos + bytes > length)
+            return false;
+        std::memcpy(out, base + pos, bytes);
+        pos += bytes;
+        return true;
+    }
+
+    bool readString(size_t &pos, std::string &out) const
+    {
+        uint32_t len;
+        if (!read(pos, &len, sizeof(len)) || pos + len > length)
+            return false;
+        out.assign(base + pos, len);
+        pos += len;
+        return true;
+    }
+
+    // Read the header and index the chunks, the values themselves are not touched
+    bool parse()
+    {
+        using namespace waveform_detail;
+        size_t pos = 0;
+        char fileMagic[8];
+        uint32_t fileVersion, numSignals;
+        if (!read(pos, fileMagic, sizeof(fileMagic)) || std::memcmp(fileMagic, magic, sizeof(magic)) != 0)
+            return false;
+        if (!read(pos, &fileVersion, sizeof(fileVersion)) || fileVersion != version)
+            return false;
+        // Every signal takes at least its type and two string lengths
+        if (!read(pos, &numSignals, sizeof(numSignals)) || numSignals > (length - pos) / (3 * sizeof(uint32_t)))
+            return false;
+        signals.resize(numSignals);
+        for (auto &sig : signals)
+        {
+            if (!read(pos, &sig.type, sizeof(sig.type)) || !readString(pos, sig.name) || !readString(pos, sig.unit))
+                return false;
+        }
+        pos = padTo8(pos);
+
+        while (pos < length)
+        {
+            uint64_t rows;
+            if (!read(pos, &rows, sizeof(rows)))
+                return false;
+            Chunk chunk{static_cast<size_t>(rows), {}};
+            for (const auto &sig : signals)
+            {
+                // Checked before multiplying, a corrupt row count must not wrap pos around
+                size_t elementSize = sig.type == typeFloat32 ? sizeof(float) : sizeof(double);
+                if (pos > length || rows > (length - pos) / elementSize)
+                    return false;
+                chunk.offsets.push_back(pos);
+                pos += padTo8(rows * elementSize);
+            }
+            if (pos > length)
+                return false;
+            totalRows += rows;
+            chunks.push_back(std::move(chunk));
+        }
+        return true;
+    }
+
+    void unmap()
+    {
+        if (base)
+            munmap(const_cast<char *>(base), length);
+        base = nullptr;
+    }
+
+    const char *base;
+    size_t length;
+    size_t totalRows;
+    std::vector<Signal> signals;
+    std::vector<Chunk> chunks;
+};
+
+// Convert a binary waveform to the comma separated text format read by plot.sh / plot_jj.sh
+inline bool convertWaveformToText(const std::string &binaryFile, const std::string &textFile)
+{
+    WaveformReader reader(binaryFile);
+    if (!reader.isOpen())
+        return false;
+    std::ofstream file(textFile);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Could not open file " << textFile << std::endl;
+        return false;
+    }
+
+    for (size_t sig = 0; sig < reader.numSignals(); ++sig)
+        file << (sig > 0 ? ", " : "") << reader.signalName(sig);
+    file << "\n";
+    for (size_t chunk = 0; chunk < reader.numChunks(); ++chunk)
+    {
+        for (size_t row = 0; row < reader.chunkRows(chunk); ++row)
+        {
+            for (size_t sig = 0; sig < reader.numSignals(); ++sig)
+                file << (sig > 0 ? ", " : "") << reader.value(chunk, sig, row);
+            file << "\n";
+        }
+    }
+    return true;
+}
+
+#endif // WAVEFORM_H